@@ -0,0 +1,37 @@
+# bash completion for notes; source it from ~/.bashrc
+#
+#	source /path/to/notes.bash
+#
+# The candidates are produced by 'notes --complete', which is answered by
+# the service if 'notes --serve' is running.
+
+_notes() {
+	local cur=${COMP_WORDS[COMP_CWORD]} prev=${COMP_WORDS[COMP_CWORD-1]}
+	local sec=() c i
+
+	COMPREPLY=()
+	if [[ $cur == -* ]]; then
+		COMPREPLY=( $(compgen -W "-a -a+ -l -f -v -p -e -d -r -s -h --add --append --list
+			--files --view --print --edit --delete --rename --section --all --rcfile
+			--onstart --onexit --history --restore --serve --complete --help --version" -- "$cur") )
+		return
+	fi
+	case $prev in
+	-c|--rcfile)
+		COMPREPLY=( $(compgen -f -- "$cur") )
+		return ;;
+	-s|--section)
+		while IFS= read -r c; do
+			[[ $c == */ ]] && COMPREPLY+=( "$(printf '%q' "${c%/}")" )
+		done < <(notes --complete "$cur" 2>/dev/null)
+		return ;;
+	esac
+	for (( i = 1; i < COMP_CWORD - 1; i ++ )); do
+		[[ ${COMP_WORDS[i]} == -s || ${COMP_WORDS[i]} == --section ]] && sec=( -s "${COMP_WORDS[i+1]}" )
+	done
+	while IFS= read -r c; do
+		COMPREPLY+=( "$(printf '%q' "$c")" )
+	done < <(notes --complete "${sec[@]}" "$cur" 2>/dev/null)
+	[[ ${#COMPREPLY[@]} == 1 && ${COMPREPLY[0]} == */ ]] && compopt -o nospace
+}
+complete -F _notes notes
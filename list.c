@@ -103,6 +103,29 @@ bool list_delete(list_t *list, list_node_t *node) {
 	return false;
 	}
 
+// delete all nodes that 'func' returns true; returns the number of deleted nodes
+size_t list_delete_if(list_t *list, bool (*func)(void *data, void *arg), void *arg) {
+	list_node_t	*cur = list->head, *prev = NULL, *next;
+	size_t	count = 0;
+	
+	while ( cur ) {
+		next = cur->next;
+		if ( func(cur->data, arg) ) {
+			if ( prev )	prev->next = next;
+			else		list->head = next;
+			if ( cur == list->tail )	list->tail = prev;
+			if ( cur->size )
+				free(cur->data);
+			free(cur);
+			count ++;
+			}
+		else
+			prev = cur;
+		cur = next;
+		}
+	return count;
+	}
+
 // returns the number of the nodes
 size_t list_count(const list_t *list) {
 	size_t count = 0;
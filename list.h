@@ -60,6 +60,9 @@ list_node_t *list_addptr(list_t *list, void *ptr);
 // delete node
 bool list_delete(list_t *list, list_node_t *node);
 
+// delete all nodes that 'func' returns true; returns the number of deleted nodes
+size_t list_delete_if(list_t *list, bool (*func)(void *data, void *arg), void *arg);
+
 // returns the number of the nodes
 size_t list_count(const list_t *list);
 
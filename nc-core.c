@@ -20,9 +20,16 @@
  */
 
 #include "nc-plus.h"
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
 
-typedef struct { int fg, bg, id; } pair_t;
+typedef struct { int fg, bg, id; } pair_t;	// id 0: empty slot
+
+// fg/bg -> pair lookup; open addressing, power of 2, kept under 3/4 full
+#define PAIR_SLOTS	256
 static pair_t*	pair_table = NULL;
+static int		pair_slots = 0;
 static int		pair_count = 0;
 
 // translate table from ANSI to VGA
@@ -30,27 +37,54 @@ static int to_vga[] =
 //   VGA     0  1  2  3  4  5  6  7  8   9  10  11  12  13  14  15
 { /* ANSI */ 0, 4, 2, 6, 1, 5, 3, 7, 8, 12, 10, 14,  9, 13, 11, 15 };
 
+// the slot of fg/bg in pair_table, either its own or the empty one to store it
+static pair_t *nc_pairslot(int fg, int bg) {
+	unsigned h = ((unsigned) fg * 0x9E3779B1u) ^ ((unsigned) bg * 0x85EBCA77u);
+	unsigned mask = pair_slots - 1;
+
+	for ( h = (h ^ (h >> 15)) & mask; pair_table[h].id; h = (h + 1) & mask )
+		if ( pair_table[h].fg == fg && pair_table[h].bg == bg )
+			break;
+	return &pair_table[h];
+	}
+
+// double pair_table and rehash
+static void nc_pairgrow() {
+	pair_t	*old = pair_table;
+	int		n = pair_slots;
+
+	pair_slots = ( n ) ? n << 1 : PAIR_SLOTS;
+	pair_table = (pair_t *) calloc(pair_slots, sizeof(pair_t));
+	for ( int i = 0; i < n; i ++ )
+		if ( old[i].id )
+			*nc_pairslot(old[i].fg, old[i].bg) = old[i];
+	free(old);
+	}
+
 // create a new color pair and store it to pair_table
 int nc_createpair(int fg, int bg) {
-	if ( pair_table )
-		pair_table = (pair_t *) realloc(pair_table, sizeof(pair_t) * (pair_count+1));
-	else
-		pair_table = (pair_t *) malloc(sizeof(pair_t) * (pair_count+1));
-	pair_table[pair_count].fg = fg;
-	pair_table[pair_count].bg = bg;
-	pair_table[pair_count].id = 0x10 + pair_count;
-	init_pair(pair_table[pair_count].id, fg, bg);
-	pair_count ++;
-	return pair_table[pair_count - 1].id;
+	pair_t	*p;
+	int		id = 0x10 + pair_count ++;
+
+	init_pair(id, fg, bg);
+	if ( (pair_count + 1) * 4 > pair_slots * 3 )
+		nc_pairgrow();
+	p = nc_pairslot(fg, bg);
+	if ( p->id == 0 ) {	// the first pair of fg/bg is the one to reuse
+		p->fg = fg;
+		p->bg = bg;
+		p->id = id;
+		}
+	return id;
 	}
 int nc_createvgapair(int fg, int bg) { return nc_createpair(to_vga[fg & 0xf], to_vga[bg &0xf]); }
 
 // get the pair no of fg/bg, creates a new one if not found
 int nc_getpairof(int fg, int bg) {
 	if ( pair_table ) {
-		for ( int i = 0; i < pair_count; i ++ )
-			if ( pair_table[i].fg == fg && pair_table[i].bg == bg )
-				return pair_table[i].id;
+		pair_t *p = nc_pairslot(fg, bg);
+		if ( p->id )
+			return p->id;
 		}
 	return nc_createpair(fg, bg);
 	}
@@ -111,7 +145,37 @@ void nc_close() {
 	if ( pair_table )
 		free(pair_table);
 	pair_table = NULL;
-	pair_count = 0;
+	pair_slots = pair_count = 0;
+	}
+
+// bytes written by the thread so far: the wchar of /proc/thread-self/io (linux)
+static size_t nc_wchar(int fd) {
+	char	buf[512], *p;
+	ssize_t	n;
+
+	if ( fd < 0 || (n = pread(fd, buf, sizeof(buf) - 1, 0)) <= 0 )
+		return 0;
+	buf[n] = '\0';
+	return ( (p = strstr(buf, "wchar:")) != NULL ) ? strtoull(p + 6, NULL, 10) : 0;
+	}
+
+// flushes the windows staged with wnoutrefresh() in one update of the terminal;
+// if 'count' returns the bytes that were written to the terminal, otherwise 0.
+// The counter is the calling thread's, the writes of other threads (the file
+// copies of a bulk operation) are not counted; it must be the same thread always.
+size_t nc_update(bool count) {
+	static int fd = -2;
+	size_t	before;
+
+	if ( !count ) {
+		doupdate();
+		return 0;
+		}
+	if ( fd == -2 )
+		fd = open("/proc/thread-self/io", O_RDONLY | O_CLOEXEC);
+	before = nc_wchar(fd);
+	doupdate();
+	return nc_wchar(fd) - before;
 	}
 
 void nc_setvgacolor(WINDOW *win, int fg, int bg)	{ wattron (win, COLOR_PAIR(nc_getpairof(to_vga[fg & 0xF], to_vga[bg & 0xF]))); }
@@ -143,6 +207,122 @@ static void nc_hpair(WINDOW *win, int mode, char d1, char d0) {
 #define	CSTACK_MAX	16
 static int cstack[CSTACK_MAX], csp;
 
+// handles the escape at p (after the '$'), returns the next character to parse
+static const char *nc_escape(WINDOW *win, const char *p) {
+	switch ( tolower(*p) ) {
+	ccase('b', A_BOLD)
+	ccase('r', A_REVERSE)
+	ccase('d', A_DIM)
+	ccase('u', A_UNDERLINE)
+	case 'c': // vga color
+		if ( *p == toupper(*p) ) {
+			if ( isxdigit(p[1]) && isxdigit(p[2]) ) {
+				if ( csp < CSTACK_MAX ) {
+					if ( has_colors() )
+						nc_hclr(win, true, p[1], p[2]);
+					cstack[csp++] = (p[1] << 8) | p[2];
+					}
+				p += 2;
+				}
+			}
+		else { // pop previous colors
+			if ( csp ) {
+				int c = cstack[--csp];
+				if ( has_colors() )
+					nc_hclr(win, false, c >> 8, c & 0xFF);
+				}
+			}
+		break;
+	case '\0':
+		return p;
+	default: // not recognized, print it ($$ prints dolar)
+		waddnstr(win, p, 1);
+		}
+	return p + 1;
+	}
+
+// prints s padded to width; precision < 0 for the whole string
+static void nc_addpad(WINDOW *win, const char *s, int width, int prec, bool left) {
+	int len = ( prec < 0 ) ? strlen(s) : strnlen(s, prec);
+
+	if ( !left )
+		for ( ; width > len; width -- )	waddch(win, ' ');
+	waddnstr(win, s, len);
+	for ( ; width > len; width -- )	waddch(win, ' ');
+	}
+
+// prints one converted value with the normalized spec
+#define nc_addconv(win, spec, v) { \
+	char num[64], *b = num; int n = snprintf(num, sizeof(num), spec, v); \
+	if ( n >= (int) sizeof(num) && (b = (char *) malloc(n + 1)) != NULL ) snprintf(b, n + 1, spec, v); \
+	if ( b ) waddnstr(win, b, -1); \
+	if ( b != num ) free(b); }
+
+// handles the conversion at p (after the '%'), returns the next character to parse
+static const char *nc_convert(WINDOW *win, const char *p, va_list *ap) {
+	char	spec[64], *d = spec;
+	int		width = -1, prec = -1, lng = 0;
+	bool	left = false;
+
+	*d ++ = '%';
+	for ( ; *p && strchr("-+ #0'", *p); p ++ ) {
+		if ( *p == '-' ) left = true;
+		if ( d < spec + 8 ) *d ++ = *p;
+		}
+	if ( *p == '*' ) {
+		p ++;
+		if ( (width = va_arg(*ap, int)) < 0 ) { left = true; width = -width; }
+		}
+	else
+		for ( width = 0; isdigit(*p); p ++ ) width = width * 10 + (*p - '0');
+	if ( *p == '.' ) {
+		p ++;
+		if ( *p == '*' ) { p ++; prec = va_arg(*ap, int); }
+		else for ( prec = 0; isdigit(*p); p ++ ) prec = prec * 10 + (*p - '0');
+		}
+	if ( left && d < spec + 9 && !strchr(spec, '-') ) *d ++ = '-';
+	if ( width > 0 ) d += sprintf(d, "%d", width);
+	if ( prec >= 0 ) d += sprintf(d, ".%d", prec);
+	for ( ; *p && strchr("hlLqjzt", *p); p ++ ) {
+		if ( *p == 'l' || *p == 'q' || *p == 'L' )	lng ++;
+		if ( *p == 'j' || *p == 'z' || *p == 't' )	lng = 2;
+		*d ++ = *p;
+		}
+	*d ++ = *p;
+	*d = '\0';
+
+	switch ( *p ) {
+	case 's': {
+		const char *s = va_arg(*ap, const char *);
+		nc_addpad(win, ( s ) ? s : "(null)", width, prec, left);
+		break; }
+	case 'c':
+		nc_addconv(win, spec, va_arg(*ap, int));
+		break;
+	case 'd': case 'i': case 'o': case 'u': case 'x': case 'X':
+		if ( lng >= 2 )		nc_addconv(win, spec, va_arg(*ap, long long))
+		else if ( lng )		nc_addconv(win, spec, va_arg(*ap, long))
+		else				nc_addconv(win, spec, va_arg(*ap, int))
+		break;
+	case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+		if ( lng )			nc_addconv(win, spec, va_arg(*ap, long double))
+		else				nc_addconv(win, spec, va_arg(*ap, double))
+		break;
+	case 'p':
+		nc_addconv(win, spec, va_arg(*ap, void *));
+		break;
+	case 'n':
+		(void) va_arg(*ap, void *);
+		break;
+	case '\0':
+		return p;
+	default: // not recognized, %% too
+		waddnstr(win, p, 1);
+		}
+	return p + 1;
+	}
+#undef nc_addconv
+
 // ncurses printf with codes/colors
 // $ = escape character, $$ = print dolar
 // $B,$U,$R,$D = enable bold, underline, reverse, dim
@@ -150,14 +330,11 @@ static int cstack[CSTACK_MAX], csp;
 // $Cxx = set VGA colors, x is hexadecimal digit, both digits represents VGA
 // text mode attributes (blink|intensity-background-foreground)
 //
-void nc_mvwprintf(WINDOW *win, int y, int x, const char *fmt, ...) {
-	char	msg[LINE_MAX], buf[LINE_MAX];
-	char	*p = msg, *b = buf;
-
-	va_list ap;
-	va_start(ap, fmt);
-	vsnprintf(msg, LINE_MAX, fmt, ap);
-	va_end(ap);
+// the format is parsed once, the text between escapes and conversions goes
+// to the window as is; the escapes are not parsed in the arguments
+void nc_vmvwprintf(WINDOW *win, int y, int x, const char *fmt, va_list ap) {
+	const char *p = fmt, *s;
+	va_list	aq;
 
 	if ( y >= 0 && x >= 0 )
 		wmove(win, y, x);
@@ -165,51 +342,106 @@ void nc_mvwprintf(WINDOW *win, int y, int x, const char *fmt, ...) {
 		wmove(win, y, getcurx(win));
 	else if ( x >= 0 )
 		wmove(win, getcury(win), x);
-		
+
+	va_copy(aq, ap);
 	while ( *p ) {
-		switch ( *p ) {
-		case '$':
-			p ++;
-			if ( b > buf ) { *b = '\0'; waddstr(win, buf); b = buf; } // flash buffer
-			switch ( tolower(*p) ) {
-			ccase('b', A_BOLD)
-			ccase('r', A_REVERSE)
-			ccase('d', A_DIM)
-			ccase('u', A_UNDERLINE)
-			case 'c': // vga color
-				if ( *p == toupper(*p) ) {
-					p ++;
-					if ( isxdigit(*p) && isxdigit(p[1]) ) {
-						if ( csp < CSTACK_MAX ) {
-							if ( has_colors() )
-								nc_hclr(win, true, p[0], p[1]);
-							cstack[csp++] = (p[0] << 8) | p[1];
-							}
-						p ++;
-						}
-					}
-				else { // pop previous colors
-					if ( csp ) {
-						int c = cstack[--csp];
-						if ( has_colors() )
-							nc_hclr(win, false, c >> 8, c & 0xFF);
-						}
+		for ( s = p; *p && *p != '$' && *p != '%'; p ++ );
+		if ( p > s )
+			waddnstr(win, s, p - s);
+		if ( *p == '$' )
+			p = nc_escape(win, p + 1);
+		else if ( *p == '%' )
+			p = nc_convert(win, p + 1, &aq);
+		}
+	va_end(aq);
+	}
+
+void nc_mvwprintf(WINDOW *win, int y, int x, const char *fmt, ...) {
+	va_list ap;
+	va_start(ap, fmt);
+	nc_vmvwprintf(win, y, x, fmt, ap);
+	va_end(ap);
+	}
+#undef ccase
+
+#define nc_wprintf(w,f,...)	nc_mvwprintf(w,-1,-1,f,__VA_ARGS__)
+#define nc_printf(f,...)	nc_mvwprintf(stdscr,-1,-1,f,__VA_ARGS__)
+
+// appends a run to the array of nc_compile()
+static nc_run_t *nc_addrun(nc_run_t *runs, int *count, int *alloc, nc_run_t run) {
+	if ( *count == *alloc ) {
+		*alloc = ( *alloc ) ? *alloc << 1 : 16;
+		runs = (nc_run_t *) realloc(runs, sizeof(nc_run_t) * *alloc);
+		}
+	runs[(*count) ++] = run;
+	return runs;
+	}
+
+// compiles the escapes of fmt (no conversions) to runs of text with the same
+// attributes, see nc_mvwputruns(); the runs point into fmt
+nc_run_t *nc_compile(const char *fmt) {
+	nc_run_t	*runs = NULL, run = { 0, 0, -1, NULL, 0 };
+	int			count = 0, alloc = 0, sp = 0, lit = 0;
+	short		stack[CSTACK_MAX];
+	attr_t		a;
+	const char	*p = fmt, *s;
+
+	for ( ;; ) {
+		for ( s = p, p += lit, lit = 0; *p && *p != '$'; p ++ );
+		if ( p > s ) {
+			run.text = s;
+			run.len  = p - s;
+			runs = nc_addrun(runs, &count, &alloc, run);
+			}
+		if ( *p == '\0' )
+			break;
+		a = 0;
+		switch ( tolower(*++ p) ) {
+		case 'b': a = A_BOLD;		break;
+		case 'r': a = A_REVERSE;	break;
+		case 'd': a = A_DIM;		break;
+		case 'u': a = A_UNDERLINE;	break;
+		case 'c':
+			if ( *p == 'C' ) {
+				if ( isxdigit(p[1]) && isxdigit(p[2]) ) {
+					if ( sp < CSTACK_MAX )
+						stack[sp ++] = ( has_colors() )
+							? nc_getpairof(to_vga[c2dec(p[1]) & 0xF], to_vga[c2dec(p[2]) & 0xF]) : -1;
+					p += 2;
 					}
-				break;
-			default: // not recognized
-				*b ++ = *p;
 				}
+			else if ( sp )
+				sp --;
+			run.pair = ( sp ) ? stack[sp - 1] : -1;
 			break;
-		default:
-			*b ++ = *p;
+		case '\0':
+			continue;
+		default: // not recognized, printed with the text after it
+			lit = 1;
+			continue;
+			}
+		if ( a ) {
+			if ( *p == toupper(*p) )	{ run.on |= a; run.off &= ~a; }
+			else						{ run.off |= a; run.on &= ~a; }
 			}
 		p ++;
 		}
-	if ( b > buf ) { *b = '\0'; waddstr(win, buf); b = buf; } // flash buffer
+	run.text = NULL;
+	run.len  = 0;
+	return nc_addrun(runs, &count, &alloc, run);
 	}
-#undef ccase
-
-#define nc_wprintf(w,f,...)	nc_mvwprintf(w,-1,-1,f,__VA_ARGS__)
-#define nc_printf(f,...)	nc_mvwprintf(stdscr,-1,-1,f,__VA_ARGS__)
 
+// prints the runs of nc_compile(), the attributes are relative to the window's
+void nc_mvwputruns(WINDOW *win, int y, int x, const nc_run_t *runs) {
+	attr_t	attr;
+	short	pair;
 
+	if ( y >= 0 || x >= 0 )
+		wmove(win, ( y >= 0 ) ? y : getcury(win), ( x >= 0 ) ? x : getcurx(win));
+	wattr_get(win, &attr, &pair, NULL);
+	for ( ; runs->text; runs ++ ) {
+		wattr_set(win, (attr | runs->on) & ~runs->off, ( runs->pair >= 0 ) ? runs->pair : pair, NULL);
+		waddnstr(win, runs->text, runs->len);
+		}
+	wattr_set(win, attr, pair, NULL);
+	}
@@ -52,6 +52,7 @@ extern "C" {
 // init/close
 void nc_init ();
 void nc_close();
+size_t nc_update(bool count);
 
 // keyboard
 void nc_use_default_keymap();
@@ -79,9 +80,44 @@ void nc_wtitle(WINDOW *win, const char * title, int align);
 
 // printf with "escape-codes"
 void nc_mvwprintf(WINDOW *win, int y, int x, const char *fmt, ...);
+void nc_vmvwprintf(WINDOW *win, int y, int x, const char *fmt, va_list ap);
 #define nc_wprintf(w,f,...)	nc_mvwprintf(w,-1,-1,f,__VA_ARGS__)
 #define nc_printf(f,...)	nc_mvwprintf(stdscr,-1,-1,f,__VA_ARGS__)
 
+// constant "escape-codes" text compiled once to runs of the same attributes
+typedef struct {
+	attr_t		on, off;			// attributes set and cleared on the window's
+	short		pair;				// color pair, -1 for the window's
+	const char	*text;				// NULL at the end
+	int			len;
+	} nc_run_t;
+
+nc_run_t *nc_compile(const char *fmt);
+void nc_mvwputruns(WINDOW *win, int y, int x, const nc_run_t *runs);
+
+// line editor; the utf8 text is kept in a gap buffer (the gap is at the cursor),
+// only the cells that changed are redrawn; no allocation after nc_ledit_init()
+typedef struct {
+	WINDOW	*win;
+	int		y, x;				// position on the window
+	attr_t	attr;				// attributes of the text, added to the window's
+	char	*buf;				// text before the cursor [0,gap), after [gap_end,size)
+	int		size, gap, gap_end;
+	int		maxlen, len;		// max and current length in characters, maxlen is the width too
+	bool	insert;
+	char	*text;				// work buffer for the whole text
+	char	*shown;				// the text as displayed
+	int		shown_len, shown_width;
+	} nc_ledit_t;
+
+void nc_ledit_init(nc_ledit_t *ed, WINDOW *w, int y, int x, int maxlen, const char *text);
+void nc_ledit_free(nc_ledit_t *ed);
+void nc_ledit_resize(nc_ledit_t *ed, WINDOW *w, int maxlen);
+int  nc_ledit_key(nc_ledit_t *ed, int key);
+void nc_ledit_draw(nc_ledit_t *ed);
+void nc_ledit_invalidate(nc_ledit_t *ed);
+char *nc_ledit_text(const nc_ledit_t *ed, char *dest);
+
 // input string 
 // *editstr functions = edit contents of str; str must be a null terminated string
 // *readstr functions = the typical gets, str does not need to initialized
@@ -96,6 +132,7 @@ bool nc_wreadstr(WINDOW *w, char *s, int m);
 
 // tools
 void nc_view(const char *title, const char *body);
+void nc_viewbuf(const char *title, const char *text, size_t size);
 int  nc_listbox(const char *title, const char **items, int default_index /* = 0 */);
 
 #ifdef __cplusplus
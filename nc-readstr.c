@@ -21,98 +21,221 @@
 
 #include <wchar.h>
 #include <stdlib.h>
+#include <string.h>
 #include "nc-plus.h"
 
-//
-bool nc_mvweditstr(WINDOW *w, int y, int x, char *u8str, int maxlen) {
-	int		pos = 0, len, i, ocurs, key;
-	bool	insert = true;
-	wchar_t *str, *wcs, wch;
-	char	*s;
+// size of the utf8 character by its first byte
+#define LE_CSIZE(c)	(((unsigned char) (c) < 0xC0) ? 1 : ((unsigned char) (c) < 0xE0) ? 2 : ((unsigned char) (c) < 0xF0) ? 3 : 4)
+
+// width in cells of the first 'n' bytes of 'text'
+static int le_width(char *text, int n) {
+	char	c = text[n];
+	int		w;
+	
+	text[n] = '\0';
+	w = u8width(text);
+	text[n] = c;
+	return w;
+	}
+
+// initialize the editor with 'text' at the position 'y', 'x' of the window;
+// the editor uses 'maxlen' cells and accepts up to 'maxlen' characters
+void nc_ledit_init(nc_ledit_t *ed, WINDOW *w, int y, int x, int maxlen, const char *text) {
+	int		n;
+	
+	ed->win = w;
+	ed->y = y; ed->x = x;
+	ed->attr = 0;
+	ed->maxlen = maxlen;
+	ed->insert = true;
+	ed->size = maxlen * 4 + 4;
+	ed->buf = (char *) malloc(ed->size * 3);
+	ed->text = ed->buf + ed->size;
+	ed->shown = ed->text + ed->size;
+	
+	// the text, up to maxlen characters, goes before the gap
+	for ( ed->gap = ed->len = 0; text[ed->gap] && ed->len < maxlen; ed->gap += n, ed->len ++ ) {
+		n = LE_CSIZE(text[ed->gap]);
+		memcpy(ed->buf + ed->gap, text + ed->gap, n);
+		}
+	ed->gap_end = ed->size;
+	nc_ledit_invalidate(ed);
+	}
+
+// move the editor to the window 'w' (a new one after a resize) with 'maxlen'
+// cells; the text is kept up to 'maxlen' characters, the cursor goes to its end
+void nc_ledit_resize(nc_ledit_t *ed, WINDOW *w, int maxlen) {
+	char	*text = (char *) malloc(ed->size);
+	attr_t	attr = ed->attr;
+	bool	insert = ed->insert;
+	
+	nc_ledit_text(ed, text);
+	nc_ledit_free(ed);
+	nc_ledit_init(ed, w, ed->y, ed->x, maxlen, text);
+	ed->attr = attr;
+	ed->insert = insert;
+	free(text);
+	}
+
+// release the editor's buffer
+void nc_ledit_free(nc_ledit_t *ed) {
+	free(ed->buf);
+	ed->buf = ed->text = ed->shown = NULL;
+	}
+
+// the next draw repaints the whole field
+void nc_ledit_invalidate(nc_ledit_t *ed) {
+	ed->shown_len = 0;
+	ed->shown_width = -1;
+	}
+
+// copy the text to 'dest'; returns 'dest'
+char *nc_ledit_text(const nc_ledit_t *ed, char *dest) {
+	memcpy(dest, ed->buf, ed->gap);
+	memcpy(dest + ed->gap, ed->buf + ed->gap_end, ed->size - ed->gap_end);
+	dest[ed->gap + ed->size - ed->gap_end] = '\0';
+	return dest;
+	}
 
-	wcs = u8towcs(u8str);
-	str = (wchar_t *) malloc(sizeof(wchar_t) * (maxlen + 1));
-	wcscpy(str, wcs);
-	free(wcs);
-	len = wcslen(str);
+// draw the cells that changed since the last draw and put the cursor in place
+void nc_ledit_draw(nc_ledit_t *ed) {
+	int		len, n = 0, col, width;
+	attr_t	attrs;
+	short	pair;
+	
+	nc_ledit_text(ed, ed->text);
+	len = ed->gap + ed->size - ed->gap_end;
+	wattr_get(ed->win, &attrs, &pair, NULL);
+	wattron(ed->win, ed->attr);
+	if ( ed->shown_width < 0 ) {
+		mvwhline(ed->win, ed->y, ed->x, ' ', ed->maxlen);
+		ed->shown_width = 0;
+		}
+	
+	// the common part is not drawn again
+	while ( n < len && n < ed->shown_len && ed->text[n] == ed->shown[n] )
+		n ++;
+	while ( n > 0 && (ed->text[n] & 0xC0) == 0x80 )
+		n --;
+	col = le_width(ed->text, n);
+	if ( n < len || len != ed->shown_len ) {
+		mvwaddnstr(ed->win, ed->y, ed->x + col, ed->text + n, len - n);
+		width = col + u8width(ed->text + n);
+		if ( width < ed->shown_width )
+			mvwhline(ed->win, ed->y, ed->x + width, ' ', ed->shown_width - width);
+		memcpy(ed->shown, ed->text, len);
+		ed->shown_len = len;
+		ed->shown_width = width;
+		}
+	
+	wattr_set(ed->win, attrs, pair, NULL);
+	wmove(ed->win, ed->y, ed->x + le_width(ed->text, ed->gap));
+	}
+
+// execute 'key' (KEY_LEFT, KEY_RIGHT, KEY_HOME, KEY_END, KEY_BACKSPACE, KEY_DC,
+// KEY_IC or a character; the rest bytes of utf8 characters are read from the window);
+// returns 1 if the text changed, 0 if the cursor moved and -1 if the key is not used
+int nc_ledit_key(nc_ledit_t *ed, int key) {
+	char	mbs[4];
+	int		i, n;
+	
+	switch ( key ) {
+	case KEY_LEFT:
+		if ( ed->gap == 0 ) return 0;
+		for ( n = 1; (ed->buf[ed->gap - n] & 0xC0) == 0x80 && n < ed->gap; n ++ );
+		ed->gap -= n; ed->gap_end -= n;
+		memmove(ed->buf + ed->gap_end, ed->buf + ed->gap, n);
+		return 0;
+	case KEY_RIGHT:
+		if ( ed->gap_end == ed->size ) return 0;
+		n = LE_CSIZE(ed->buf[ed->gap_end]);
+		memmove(ed->buf + ed->gap, ed->buf + ed->gap_end, n);
+		ed->gap += n; ed->gap_end += n;
+		return 0;
+	case KEY_HOME:
+		ed->gap_end -= ed->gap;
+		memmove(ed->buf + ed->gap_end, ed->buf, ed->gap);
+		ed->gap = 0;
+		return 0;
+	case KEY_END:
+		n = ed->size - ed->gap_end;
+		memmove(ed->buf + ed->gap, ed->buf + ed->gap_end, n);
+		ed->gap += n; ed->gap_end = ed->size;
+		return 0;
+	case KEY_BACKSPACE:
+		if ( ed->gap == 0 ) return 0;
+		for ( n = 1; (ed->buf[ed->gap - n] & 0xC0) == 0x80 && n < ed->gap; n ++ );
+		ed->gap -= n;
+		ed->len --;
+		return 1;
+	case KEY_DC:
+		if ( ed->gap_end == ed->size ) return 0;
+		ed->gap_end += LE_CSIZE(ed->buf[ed->gap_end]);
+		ed->len --;
+		return 1;
+	case KEY_IC:
+		ed->insert = !ed->insert;
+		curs_set((ed->insert) ? 1 : 2);
+		return 0;
+		}
+	
+	// character
+	if ( key >= 0xC2 && key <= 0xF4 ) { // first byte of utf8 sequence
+		n = LE_CSIZE(key);
+		mbs[0] = key;
+		for ( i = 1; i < n; i ++ ) {
+			int c = wgetch(ed->win);
+			if ( (c & ~0x3F) != 0x80 ) // not continuation byte
+				return -1;
+			mbs[i] = c;
+			}
+		}
+	else if ( key >= ' ' && key < 0x7F ) {
+		n = 1;
+		mbs[0] = key;
+		}
+	else
+		return -1;
+	if ( !ed->insert && ed->gap_end < ed->size ) { // overwrite
+		ed->gap_end += LE_CSIZE(ed->buf[ed->gap_end]);
+		ed->len --;
+		}
+	if ( ed->len >= ed->maxlen )
+		return 0;
+	memcpy(ed->buf + ed->gap, mbs, n);
+	ed->gap += n;
+	ed->len ++;
+	return 1;
+	}
+
+// edit the string 'u8str' at 'y', 'x' of the window; up to 'maxlen' characters;
+// returns false if canceled
+bool nc_mvweditstr(WINDOW *w, int y, int x, char *u8str, int maxlen) {
+	nc_ledit_t	ed;
+	int		ocurs, key;
+	
+	nc_ledit_init(&ed, w, y, x, maxlen, u8str);
 	ocurs = curs_set(1);
 	while ( true ) {
-		// print
-		
-		s = wcstou8(str);
-		if ( s ) {
-			mvwprintw(w, y, x, "%s", s);
-			free(s);
-			}
-		mvwhline (w, y, x + len, ' ', maxlen - len);
-		
-		// get key
-		key = mvwgetch(w, y, x + pos);
-		if ( u8ischar(key) ) {
-			char mbs[7];
-			int keylen = u8csize(key);
-			mbs[0] = key;
-			for ( i = 1; i < keylen; i ++ )
-				mbs[i] = wgetch(w);
-			mbs[keylen] = '\0';
-			wch = u8towc(mbs);
-			}
-		else
-			wch = (wchar_t) key;
-		
-		// execute
+		nc_ledit_draw(&ed);
+		key = wgetch(w);
 		switch ( key ) {
-		case KEY_LEFT:	if ( pos ) pos --; break;
-		case KEY_RIGHT:	if ( str[pos] ) pos ++; break;
-		case KEY_HOME:	pos = 0; break;
-		case KEY_END:	pos = len; break;
 		case '\010': case '\x7f':
-		case KEY_BACKSPACE:
-			if ( pos ) {
-				pos --; len --;
-				for ( i = pos; str[i]; i ++ )
-					str[i] = str[i+1];
-				str[len] = L'\0';
-				}
-			break;
-		case KEY_DC:
-			if ( str[pos] ) {
-				for ( i = pos; str[i]; i ++ )
-					str[i] = str[i+1];
-				len --;
-				}
-			break;
-		case KEY_IC:	
-			insert = !insert;
-			curs_set((insert)?1:2);
+			nc_ledit_key(&ed, KEY_BACKSPACE);
 			break;
 		case 27: case '': case '': case '':
 		case KEY_CANCEL:
 			curs_set(ocurs);
-			free(str);
+			nc_ledit_free(&ed);
 			return false; // canceled
 		case '\r': case '\n':
 		case KEY_ENTER: 
-			mvwprintw(w, y, x, "%ls", str);
-			mvwhline (w, y, x + len, ' ', maxlen - len);
 			curs_set(ocurs);
-			u8cpytostr(u8str, str);
+			nc_ledit_text(&ed, u8str);
+			nc_ledit_free(&ed);
 			return true;
 		default:
-			if ( len < maxlen ) {
-				if ( insert ) {
-					for ( i = len; i >= pos; i -- )
-						str[i+1] = str[i];
-					str[pos] = wch;
-					str[++ len] = L'\0';
-					}
-				else {
-					str[pos] = key;
-					if ( pos == len )
-						str[++ len] = L'\0';
-					}
-				pos ++;
-				}
+			nc_ledit_key(&ed, key);
 			}
 		}
 	return false; // never comes here
@@ -20,13 +20,88 @@
  */
 
 #include "nc-plus.h"
+#include <string.h>
 
-//
-void nc_view(const char *title, const char *body) {
-	int		x, y, dx, dy, c, exf = 0, i, lines, wlines, offset;
-	char	**text = text_to_lines(body);
+// draws 'n' bytes of 'p' from column '*col', clipped at 'maxcol'
+static void view_put(WINDOW *w, const char *p, size_t n, size_t *col, size_t maxcol) {
+	size_t	fit = u8fit(p, n, col, maxcol);
+	if ( fit )
+		waddnstr(w, p, fit);
+	}
+
+// draws a line at row 'y' of the window; the matches of 'pat' are highlighted
+static void view_line(WINDOW *w, int y, const char *p, size_t len, const char *pat, size_t plen) {
+	size_t	col = 0, maxcol = getmaxx(w);
+	const char *m;
+
+	wmove(w, y, 0);
+	while ( plen && (m = memmem(p, len, pat, plen)) != NULL && col < maxcol ) {
+		view_put(w, p, m - p, &col, maxcol);
+		wattron(w, A_REVERSE);
+		view_put(w, m, plen, &col, maxcol);
+		wattroff(w, A_REVERSE);
+		len -= (m - p) + plen;
+		p = m + plen;
+		}
+	view_put(w, p, len, &col, maxcol);
+	}
+
+// searches 'pat' from line 'from' to the end and then from the beginning
+static bool view_next(lindex_t *li, size_t from, const char *pat, size_t *found) {
+	size_t	plen = strlen(pat), start = li->lines[from];
+	const char *m;
+
+	if ( (m = memmem(li->text + start, li->size - start, pat, plen)) == NULL )
+		m = memmem(li->text, MIN(li->size, start + plen), pat, plen);
+	if ( m == NULL )
+		return false;
+	*found = lindex_find(li, m - li->text);
+	return true;
+	}
+
+// searches 'pat' from line 'from' to the beginning and then from the end
+static bool view_prev(lindex_t *li, size_t from, const char *pat, size_t *found) {
+	size_t	plen = strlen(pat), len, count = lindex_count(li);
+	const char *p;
+
+	for ( size_t i = 0; i < count; i ++ ) {
+		size_t	n = (from + count - i) % count;
+		p = lindex_line(li, n, &len);
+		if ( memmem(p, len, pat, plen) ) {
+			*found = n;
+			return true;
+			}
+		}
+	return false;
+	}
+
+// returns the offset 'want' limited to the last one that fills the window;
+// the text is indexed only up to the end of that window
+static size_t view_clamp(lindex_t *li, size_t want, int wlines) {
+	if ( lindex_has(li, want + wlines - 1) )
+		return want;
+	return ( li->count > (size_t) wlines ) ? li->count - wlines : 0;
+	}
+
+// the outer frame: box, title and the end-of-text mark
+static void view_frame(WINDOW *wout, const char *title, bool eot) {
+	box(wout, 0, 0);
+	if ( title ) nc_wtitle(wout, title, 0);
+	// ␄
+	nc_mvwprintf(wout, getmaxy(wout) - 2, getmaxx(wout) - 3, (eot) ? "$C20 $c" : "$C20↓$c");
+	}
+
+// pager for 'size' bytes of 'text'; the text does not need to be null terminated;
+// only the visible lines are drawn and the lines are indexed as they are reached,
+// so a large (mapped) file is not read until it is needed
+void nc_viewbuf(const char *title, const char *text, size_t size) {
+	int		x, y, dx, dy, c, exf = 0, wlines;
+	size_t	offset, found, len, cur = 0; // 'cur' is the line of the current match
+	char	pat[256] = "";
+	lindex_t li;
+	const char *p;
 	
-	for ( lines = 0; text[lines]; lines ++ ); // count lines in the text
+	lindex_init(&li, text, size);
 	
 	// outer window
 	x = 10; y = 5;
@@ -35,33 +110,26 @@ void nc_view(const char *title, const char *body) {
 	WINDOW	*wout = newwin(dy, dx, y, x);
 	refresh();
 	keypad(wout, TRUE);
-	box(wout, 0, 0);
-	if ( title ) nc_wtitle(wout, title, 0);
 	
 	WINDOW	*w = subwin(wout, dy - 4, dx - 6, y + 2, x + 3);
 	keypad(w, TRUE);
 	wlines = dy - 4;
-	wrefresh(wout);
 
 	offset = 0;
 	do {
-		// EOT
-		bool eot = (lines - offset <= getmaxy(w));
-		if ( eot ) {
-			offset = lines - getmaxy(w);
-			if ( offset < 0 ) offset = 0;
-			// ␄
-			nc_mvwprintf(wout, getmaxy(wout) - 2, getmaxx(wout) - 3, "$C20 $c");
-			}
-		else
-			nc_mvwprintf(wout, getmaxy(wout) - 2, getmaxx(wout) - 3, "$C20↓$c");
-		wrefresh(wout);
+		// w shares the memory of wout, both are staged and sent once
+		werase(wout);
+		view_frame(wout, title, !lindex_has(&li, offset + wlines));
 
-		//
+		// only the lines of the viewport
 		werase(w);
-		for ( i = offset, y = 0; i < lines; i ++, y ++ )
-			mvwprintw(w, y, 0, "%s", text[i]);
-		wrefresh(w);
+		for ( y = 0; y < wlines && lindex_has(&li, offset + y); y ++ ) {
+			p = lindex_line(&li, offset + y, &len);
+			view_line(w, y, p, len, pat, strlen(pat));
+			}
+		wnoutrefresh(wout);
+		wnoutrefresh(w);
+		doupdate();
 		
 		c = wgetch(w);
 		switch ( c ) {
@@ -74,21 +142,45 @@ void nc_view(const char *title, const char *body) {
 				offset --;
 			break;
 		case 'j': case KEY_DOWN:
-			if ( offset < (lines - 1) )
-				offset ++;
+			offset = view_clamp(&li, offset + 1, wlines);
 			break;
 		case KEY_PPAGE:
-			offset -= wlines;
-			if ( offset < 0 )
-				offset = 0;
+			offset = ( offset > (size_t) wlines ) ? offset - wlines : 0;
 			break;
 		case KEY_NPAGE:
-			offset += wlines;
-			if ( offset > (lines - 1) )
-				offset = lines - 1;
+			offset = view_clamp(&li, offset + wlines, wlines);
 			break;
 		case 'g': case KEY_HOME:	offset = 0; break;
-		case 'G': case KEY_END:		offset = lines - 1; break;
+		case 'G': case KEY_END:		offset = view_clamp(&li, lindex_count(&li), wlines); break;
+		case '/':
+			mvwaddch(wout, getmaxy(wout) - 1, 2, '/');
+			if ( !nc_mvwreadstr(wout, getmaxy(wout) - 1, 3, pat, MIN(dx - 6, (int) (sizeof(pat) - 1) / 4)) ) {
+				*pat = '\0';
+				break;
+				}
+			if ( *pat && size ) {
+				if ( view_next(&li, offset, pat, &found) )
+					offset = view_clamp(&li, (cur = found), wlines);
+				else
+					beep();
+				}
+			break;
+		case 'n':
+			if ( *pat && size ) {
+				if ( view_next(&li, lindex_has(&li, cur + 1) ? cur + 1 : 0, pat, &found) )
+					offset = view_clamp(&li, (cur = found), wlines);
+				else
+					beep();
+				}
+			break;
+		case 'N':
+			if ( *pat && size ) {
+				if ( view_prev(&li, ( cur ) ? cur - 1 : lindex_count(&li) - 1, pat, &found) )
+					offset = view_clamp(&li, (cur = found), wlines);
+				else
+					beep();
+				}
+			break;
 			};
 		} while ( !exf );
 
@@ -96,7 +188,11 @@ void nc_view(const char *title, const char *body) {
 	delwin(w);
 	delwin(wout);
 	refresh();
-	free(text);
+	lindex_free(&li);
 	}
 
+// view a null terminated text
+void nc_view(const char *title, const char *body) {
+	nc_viewbuf(title, body, strlen(body));
+	}
 
@@ -33,6 +33,16 @@
 #include <signal.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <sys/file.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <poll.h>
+#include <linux/fs.h>
 #include <dirent.h>
 #include <wordexp.h>
 #include <ncurses.h>
@@ -40,10 +50,14 @@
 #include <time.h>
 #include <features.h>
 #include <fnmatch.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <pthread.h>
 
 #include "list.h"
 #include "str.h"
 #include "nc-plus.h"
+#include "sha256.h"
 #if defined(__GNU_GLIBC__)
 	#define FNM_GLIBC_EXTRA FNM_EXTMATCH
 #else
@@ -64,6 +78,8 @@
 #define OPT_STDIN	0x0800
 #define OPT_PRINT	0x1000
 #define OPT_NOCLOB	0x2000
+#define OPT_HIST	0x4000
+#define OPT_REST	0x8000
 
 int		opt_flags = OPT_AUTO;
 
@@ -80,6 +96,11 @@ static char current_filter[NAME_MAX];
 static char default_ftype[NAME_MAX];
 static char onstart_cmd[LINE_MAX];
 static char onexit_cmd[LINE_MAX];
+static char onstart_async[64];	// run onstart in background (TUI), default false
+static char onexit_detach[64];	// run onexit detached (TUI), default false
+static char append_lock[64];	// lock the note while appending, default true
+static char preview_max[64];	// larger notes are not displayed in the preview
+static char frame_stats[64];	// display the terminal output per frame (TUI), default false
 static list_t *exclude;
 
 // returns true if the string 'str' is value of true
@@ -164,6 +185,10 @@ static keyfunc_t keyfunc[] = {
 { "umenu",		KEY_PRG('m') },
 { "user-menu",		KEY_PRG('m') },
 { "search",		KEY_PRG(KEY_FIND) },
+{ "preview-up",		KEY_PRG('K') },
+{ "preview-down",	KEY_PRG('J') },
+{ "preview-pgup",	KEY_PRG('b') },
+{ "preview-pgdn",	KEY_PRG(' ') },
 { NULL, 0 } };
 
 // setup default keymap
@@ -200,6 +225,10 @@ void set_default_keymap() {
 	nc_setkey("nav", '!', KEY_F(10), 0);	// execute
 //	nc_setkey("nav", 'f', 0);	// set filter test
 	nc_setkey("nav", 'f', 0);	// file manager
+	nc_setkey("nav", 'K', 0);	// scroll the preview
+	nc_setkey("nav", 'J', 0);
+	nc_setkey("nav", 'b', 0);
+	nc_setkey("nav", ' ', 0);
 	}
 
 // map key to command
@@ -305,8 +334,10 @@ void keymap_add(const char *pars) {
 // rule view *.txt   less %f
 // rule view *.pdf   okular %f
 // rule edit *       $EDITOR %f
+// rule view *.log   @internal
 typedef struct { int code; char pattern[PATH_MAX], command[LINE_MAX]; } rule_t;
 static list_t *rules;
+#define RULE_INTERNAL	"@internal"		// command of the internal viewer
 
 // add rule to list
 void rule_add(const char *pars) {
@@ -340,65 +371,386 @@ void rule_add(const char *pars) {
 		}
 	}
 
-//
+// === command runner =======================================================
+
+// Simple command lines (words, quotes, $VAR, ${VAR:-word}) are split here
+// and launched with posix_spawn(); anything else is passed to /bin/sh -c.
+
+extern char **environ;
+
+// characters that need the shell when they are not quoted
+#define SH_SPECIAL	"|&;<>()`*?[\\\n"
+// characters that need the shell at the beginning of an unquoted word
+#define SH_WSPECIAL	"#~!{"
+
+// words that are shell builtins or keywords, not programs
+static const char *sh_builtins[] = {
+	"cd", ".", ":", "source", "eval", "exec", "exit", "export", "readonly", "set",
+	"shift", "trap", "unset", "alias", "unalias", "umask", "wait", "read", "command",
+	"type", "hash", "ulimit", "getopts", "local", "return", "break", "continue",
+	"times", "jobs", "fg", "bg", "if", "then", "else", "elif", "fi", "for", "while",
+	"until", "do", "done", "case", "esac", "function", "select", "time", NULL };
+
+// appends the value of a variable to the word 'w';
+// unquoted values are splitted to more words; returns false if the shell is required
+static bool sh_addvalue(list_t *words, sbuf_t *w, bool *inword, const char *value, bool quoted) {
+	const char *p;
+
+	if ( quoted ) {
+		sbuf_add(w, value);
+		*inword = true;
+		return true;
+		}
+	for ( p = value; *p; p ++ ) {
+		if ( strchr("*?[", *p) )	// the shell will expand it
+			return false;
+		if ( *p == ' ' || *p == '\t' || *p == '\n' ) {
+			if ( *inword ) {
+				list_addstr(words, w->ptr);
+				sbuf_clear(w);
+				*inword = false;
+				}
+			}
+		else {
+			sbuf_addc(w, *p);
+			*inword = true;
+			}
+		}
+	return true;
+	}
+
+// parses $NAME, ${NAME}, ${NAME:-word} and ${NAME-word} at 'p' (next to '$');
+// returns the next position or NULL if the shell is required
+static const char *sh_expand(const char *p, list_t *words, sbuf_t *w, bool *inword, bool quoted) {
+	char	name[NAME_MAX], defval[LINE_MAX];
+	const char *value;
+	bool	braces = false, colon = false, hasdef = false;
+	int		n = 0;
+
+	if ( *p == '{' ) { braces = true; p ++; }
+	if ( !(isalpha(*p) || *p == '_') )
+		return NULL;	// $?, $$, $1, $(...), etc
+	while ( (isalnum(*p) || *p == '_') && n < NAME_MAX - 1 )
+		name[n ++] = *p ++;
+	name[n] = '\0';
+	if ( braces ) {
+		if ( p[0] == ':' && p[1] == '-' ) { colon = hasdef = true; p += 2; }
+		else if ( p[0] == '-' ) { hasdef = true; p ++; }
+		n = 0;
+		if ( hasdef ) {
+			while ( *p && *p != '}' ) {
+				if ( strchr(SH_SPECIAL SH_WSPECIAL "$'\" \t", *p) || n >= LINE_MAX - 1 )
+					return NULL;
+				defval[n ++] = *p ++;
+				}
+			}
+		defval[n] = '\0';
+		if ( *p != '}' )
+			return NULL;
+		p ++;
+		}
+	value = getenv(name);
+	if ( hasdef && (value == NULL || (colon && *value == '\0')) )
+		value = defval;
+	if ( value && !sh_addvalue(words, w, inword, value, quoted) )
+		return NULL;
+	return p;
+	}
+
+// splits the command line to words;
+// returns false if the command line needs the shell
+static bool sh_split(const char *cmd, list_t *words) {
+	const char	*p = cmd;
+	sbuf_t	w;
+	bool	inword = false, ok = true;
+
+	sbuf_init(&w);
+	while ( ok && *p ) {
+		if ( *p == '\'' ) {
+			const char *e = strchr(p + 1, '\'');
+			if ( e == NULL ) { ok = false; break; }
+			sbuf_addn(&w, p + 1, e - (p + 1));
+			inword = true;
+			p = e + 1;
+			}
+		else if ( *p == '"' ) {
+			for ( p ++; *p && *p != '"'; ) {
+				if ( *p == '`' ) { ok = false; break; }
+				if ( *p == '\\' && p[1] && strchr("$`\"\\\n", p[1]) ) {
+					if ( p[1] == '\n' ) { ok = false; break; }
+					sbuf_addc(&w, p[1]);
+					p += 2;
+					}
+				else if ( *p == '$' ) {
+					if ( (p = sh_expand(p + 1, words, &w, &inword, true)) == NULL )
+						ok = false;
+					}
+				else
+					sbuf_addc(&w, *p ++);
+				}
+			if ( ok && *p != '"' ) ok = false;
+			if ( ok ) { inword = true; p ++; }
+			}
+		else if ( *p == '$' ) {
+			if ( (p = sh_expand(p + 1, words, &w, &inword, false)) == NULL )
+				ok = false;
+			}
+		else if ( *p == ' ' || *p == '\t' ) {
+			if ( inword ) {
+				list_addstr(words, w.ptr);
+				sbuf_clear(&w);
+				inword = false;
+				}
+			p ++;
+			}
+		else if ( strchr(SH_SPECIAL, *p) || (!inword && strchr(SH_WSPECIAL, *p)) )
+			ok = false;
+		else if ( *p == '=' && words->head == NULL )	// variable assignment
+			ok = false;
+		else {
+			sbuf_addc(&w, *p ++);
+			inword = true;
+			}
+		}
+	if ( ok && inword )
+		list_addstr(words, w.ptr);
+	sbuf_free(&w);
+	if ( ok && words->head ) {
+		for ( int i = 0; sh_builtins[i]; i ++ )
+			if ( strcmp(sh_builtins[i], (const char *) words->head->data) == 0 )
+				return false;
+		}
+	return ok;
+	}
+
+#define SH_PIPE		0x01	// stdout & stderr to a pipe, returned in *fdout
+#define SH_DETACH	0x02	// new session, standard files to /dev/null, nobody waits it
+
+// starts the command line 'cmd', returns the pid or -1 on error (errno is set)
+pid_t sh_start(const char *cmd, int flags, int *fdout) {
+	list_t	*words = list_create();
+	char	**argv;
+	pid_t	pid = -1;
+	int		err, pfd[2] = { -1, -1 }, sflags;
+	posix_spawnattr_t attr;
+	posix_spawn_file_actions_t fact;
+	sigset_t	sigdef, mask;
+
+	posix_spawnattr_init(&attr);
+	posix_spawn_file_actions_init(&fact);
+	sigemptyset(&sigdef);
+	sigaddset(&sigdef, SIGINT);
+	sigaddset(&sigdef, SIGQUIT);
+	sigprocmask(SIG_SETMASK, NULL, &mask);
+	posix_spawnattr_setsigdefault(&attr, &sigdef);
+	posix_spawnattr_setsigmask(&attr, &mask);
+	sflags = POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK;
+	if ( flags & SH_PIPE ) {
+		if ( pipe2(pfd, O_CLOEXEC) != 0 ) {
+			fprintf(stderr, "pipe: errno %d: %s\n", errno, strerror(errno));
+			flags &= ~SH_PIPE;
+			}
+		else {
+			fcntl(pfd[0], F_SETFL, O_NONBLOCK);
+			posix_spawn_file_actions_addopen(&fact, 0, "/dev/null", O_RDONLY, 0);
+			posix_spawn_file_actions_adddup2(&fact, pfd[1], 1);
+			posix_spawn_file_actions_adddup2(&fact, pfd[1], 2);
+			}
+		}
+	if ( flags & SH_DETACH ) {
+		sflags |= POSIX_SPAWN_SETSID;
+		posix_spawn_file_actions_addopen(&fact, 0, "/dev/null", O_RDONLY, 0);
+		posix_spawn_file_actions_addopen(&fact, 1, "/dev/null", O_WRONLY, 0);
+		posix_spawn_file_actions_adddup2(&fact, 1, 2);
+		}
+	posix_spawnattr_setflags(&attr, sflags);
+
+	if ( sh_split(cmd, words) ) {
+		if ( words->head == NULL ) // nothing to do
+			pid = 0;
+		else {
+			argv = (char **) list_to_table(words);
+			if ( (err = posix_spawnp(&pid, argv[0], &fact, &attr, argv, environ)) != 0 ) {
+				fprintf(stderr, "%s: errno %d: %s\n", argv[0], err, strerror(err));
+				errno = err;
+				pid = -1;
+				}
+			free(argv);
+			}
+		}
+	else {
+		char *argv_sh[] = { "sh", "-c", (char *) cmd, NULL };
+		if ( (err = posix_spawn(&pid, "/bin/sh", &fact, &attr, argv_sh, environ)) != 0 ) {
+			fprintf(stderr, "/bin/sh: errno %d: %s\n", err, strerror(err));
+			errno = err;
+			pid = -1;
+			}
+		}
+	if ( flags & SH_PIPE ) {
+		close(pfd[1]);
+		if ( pid > 0 )
+			*fdout = pfd[0];
+		else
+			close(pfd[0]);
+		}
+	posix_spawn_file_actions_destroy(&fact);
+	posix_spawnattr_destroy(&attr);
+	list_destroy(words);
+	return pid;
+	}
+
+// waits the process 'pid' to finish; returns the status as system() does
+int sh_wait(pid_t pid) {
+	int		status = 0;
+	struct sigaction ign, oint, oquit;
+
+	if ( pid == 0 )
+		return 0;
+	if ( pid < 0 )
+		return (127 << 8);
+	memset(&ign, 0, sizeof(ign));
+	ign.sa_handler = SIG_IGN;
+	sigaction(SIGINT, &ign, &oint);
+	sigaction(SIGQUIT, &ign, &oquit);
+	while ( waitpid(pid, &status, 0) == -1 ) {
+		if ( errno != EINTR ) {
+			status = -1;
+			break;
+			}
+		}
+	sigaction(SIGINT, &oint, NULL);
+	sigaction(SIGQUIT, &oquit, NULL);
+	return status;
+	}
+
+// replacement of system(); runs 'cmd' and returns its wait status
+int sh_exec(const char *cmd) {
+	return sh_wait(sh_start(cmd, 0, NULL));
+	}
+
+// expands %f to 'files' and %% to '%' (outside of single quotes) and executes the command
 int note_shell(const char *precmd, const char *files) {
-	const char *p = precmd, *s;
-	char dest[LINE_MAX], *d;
-	bool sq = false, dq = false;
+	const char *p = precmd, *ps;
+	sbuf_t	dest;
+	bool	sq = false, dq = false;
+	int		status;
 	
 	setenv("NOTESDIR", ndir, 1);
 	setenv("NOTESFILES", files, 1);
-	d = dest;
+	sbuf_init(&dest);
+	ps = p;
 	while ( *p ) {
 		if ( *p == '\'' )
 			sq = !sq;
 		else if ( !sq ) {
 			if ( *p == '\"' )
 				dq = !dq;
-			else {
-				if ( *p == '%' ) {
-					switch ( *(p+1) ) {
-					case '%': // %%
-						*d ++ = '%';
-						p += 2;
-						continue;
-					case 'f': // files
-						for ( s = files; *s; *d ++ = *s ++ );
-						p += 2;
-						continue;
-						}
-					}
+			else if ( *p == '%' && (p[1] == '%' || p[1] == 'f') ) {
+				sbuf_addn(&dest, ps, p - ps);
+				if ( p[1] == '%' )
+					sbuf_addc(&dest, '%');
+				else
+					sbuf_add(&dest, files);
+				p += 2;
+				ps = p;
+				continue;
 				}
 			}
-		*d ++ = *p ++;
+		p ++;
 		}
-	*d = '\0';
-	return system(dest);
+	sbuf_addn(&dest, ps, p - ps);
+	status = sh_exec(dest.ptr);
+	sbuf_free(&dest);
+	return status;
 	}
 
-// execute rule for the file 'fn'
-bool rule_exec(int action, const char *fn) {
+// returns the number of bytes that one execution of 'cmd' can use for the
+// list of files; the list is passed twice, in the command line and in $NOTESFILES.
+size_t note_shell_limit(const char *cmd) {
+	long	arg_max = sysconf(_SC_ARG_MAX);
+	size_t	env_size = 0, limit;
+
+	if ( arg_max <= 0 )
+		arg_max = _POSIX_ARG_MAX;
+	for ( char **e = environ; *e; e ++ )
+		env_size += strlen(*e) + 1 + sizeof(char *);
+	if ( (size_t) arg_max < env_size + strlen(cmd) + 8192 )
+		return 4096;
+	limit = (arg_max - env_size - strlen(cmd) - 4096) / 2;
+	// linux does not accept a single argument (or variable) larger than 32 pages
+	if ( limit > 32 * 4096 - strlen(cmd) - 1024 )
+		limit = 32 * 4096 - strlen(cmd) - 1024;
+	return limit;
+	}
+
+// returns the first rule of 'action' that matches the file 'fn'
+rule_t *rule_find(int action, const char *fn) {
 	const char *base;
-	size_t root_dir_len = strlen(ndir) + 1;
 
 	list_node_t	*cur = rules->head;
 	if ( (base = strrchr(fn, '/')) == NULL )
-		return false;
+		return NULL;
 	base ++;
 	while ( cur ) {
 		rule_t *rule = (rule_t *) cur->data;
-		if ( rule->code == action && fnmatch(rule->pattern, base, FNM_PATHNAME | FNM_PERIOD | FNM_GLIBC_EXTRA) == 0 ) {
-			char file[PATH_MAX];
-			if ( fn[0] == '/' )
-				snprintf(file, PATH_MAX, "'%s'", fn + root_dir_len);
-			else
-				snprintf(file, PATH_MAX, "'%s'", fn);
-			note_shell(rule->command, file);
-			return true;
-			}
+		if ( rule->code == action && fnmatch(rule->pattern, base, FNM_PATHNAME | FNM_PERIOD | FNM_GLIBC_EXTRA) == 0 )
+			return rule;
 		cur = cur->next;
 		}
-	return false;
+	return NULL;
+	}
+
+// execute rule for the file 'fn'
+bool rule_exec(int action, const char *fn) {
+	size_t root_dir_len = strlen(ndir) + 1;
+	rule_t	*rule = rule_find(action, fn);
+	char	file[PATH_MAX];
+
+	if ( rule == NULL )
+		return false;
+	if ( fn[0] == '/' )
+		snprintf(file, PATH_MAX, "'%s'", fn + root_dir_len);
+	else
+		snprintf(file, PATH_MAX, "'%s'", fn);
+	// the internal viewer needs the screen, outside of it this is the pager
+	if ( strcmp(rule->command, RULE_INTERNAL) == 0 )
+		note_shell("${PAGER:-less} %f", file);
+	else
+		note_shell(rule->command, file);
+	return true;
+	}
+
+// if the view rule of the file 'fn' is @internal, displays the file in the
+// internal viewer, over the current screen; the file is mapped and only
+// the pages that are displayed or searched are read.
+// returns false if the file has to be viewed with the rule_exec().
+bool rule_view_internal(const char *fn) {
+	rule_t	*rule = rule_find('v', fn);
+	const char *title = strrchr(fn, '/') + 1;
+	struct stat st;
+	char	*map, msg[PATH_MAX + 64];
+	int		fd;
+
+	if ( rule == NULL || strcmp(rule->command, RULE_INTERNAL) != 0 )
+		return false;
+	if ( (fd = open(fn, O_RDONLY)) == -1 || fstat(fd, &st) == -1 ) {
+		snprintf(msg, sizeof(msg), "%s: errno %d: %s\n", fn, errno, strerror(errno));
+		if ( fd != -1 ) close(fd);
+		nc_view(title, msg);
+		return true;
+		}
+	if ( st.st_size == 0 )
+		nc_viewbuf(title, "", 0);
+	else if ( (map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED ) {
+		snprintf(msg, sizeof(msg), "%s: errno %d: %s\n", fn, errno, strerror(errno));
+		nc_view(title, msg);
+		}
+	else {
+		nc_viewbuf(title, map, st.st_size);
+		munmap(map, st.st_size);
+		}
+	close(fd);
+	return true;
 	}
 
 // === configuration & interpreter ==========================================
@@ -412,6 +764,11 @@ var_t var_table[] = {
 	{ "deftype", default_ftype },
 	{ "onstart", onstart_cmd },
 	{ "onexit", onexit_cmd },
+	{ "onstart_async", onstart_async },
+	{ "onexit_detach", onexit_detach },
+	{ "append_lock", append_lock },
+	{ "preview_max", preview_max },
+	{ "frame_stats", frame_stats },
 	{ NULL, NULL } };
 
 // table of commands
@@ -486,6 +843,17 @@ void read_conf(const char *rc) {
 
 // === notes ================================================================
 
+// what the first bytes of a note say about it; see note_sniff()
+typedef enum { SNIFF_NONE, SNIFF_TEXT, SNIFF_BINARY, SNIFF_HUGE } sniff_type_t;
+typedef struct {
+	sniff_type_t type;			// SNIFF_NONE if not sniffed
+	const char *desc;			// file type of the magic number, or NULL
+	size_t	lines;				// number of lines, estimated
+	ino_t	ino;				// the version of the file that was sniffed
+	off_t	size;
+	struct timespec mtim;
+	} sniff_t;
+
 typedef struct {
 	char	file[PATH_MAX];		// full path filename
 	char	name[NAME_MAX];		// name of note (basename)
@@ -495,17 +863,227 @@ typedef struct {
 	} note_t;
 list_t	*notes, *sections;
 
-// copy file
-bool copy_file(const char *src, const char *trg) {
-	FILE	*inp, *outp, *logf = stderr;
-	char	buf[LINE_MAX], *p;
-	size_t	bytes;
+// output format of the lists (-l, -f)
+enum { PL_TEXT, PL_JSON, PL_TSV, PL_NUL };
+static int		pl_format = PL_TEXT;
+static size_t	opt_limit;			// --limit, max number of notes to find; 0 = no limit
+static size_t	pl_seclen;			// width of the section column, see note_pl_width()
+
+// print a string as json string
+void json_puts(const char *s) {
+	putchar('"');
+	for ( ; *s; s ++ ) {
+		switch ( *s ) {
+		case '"':	fputs("\\\"", stdout); break;
+		case '\\':	fputs("\\\\", stdout); break;
+		case '\n':	fputs("\\n", stdout); break;
+		case '\t':	fputs("\\t", stdout); break;
+		default:
+			if ( (unsigned char) *s < 0x20 )
+				printf("\\u%04x", *s);
+			else
+				putchar(*s);
+			}
+		}
+	putchar('"');
+	}
+
+// print a string as tsv field; tab, new-line and backslash are escaped
+void tsv_puts(const char *s) {
+	for ( ; *s; s ++ ) {
+		switch ( *s ) {
+		case '\t':	fputs("\\t", stdout); break;
+		case '\n':	fputs("\\n", stdout); break;
+		case '\\':	fputs("\\\\", stdout); break;
+		default:	putchar(*s);
+			}
+		}
+	}
+
+// scanned directories and their modification time, used to rescan only the changed ones;
+// 'dirs_index' finds them by path: open addressing, power of 2, kept under 3/4 full
+typedef struct { char path[PATH_MAX]; struct timespec mtime; int wd; } dirstat_t;
+list_t	*dirs;
+static dirstat_t **dirs_index;
+static size_t	dirs_slots, dirs_used, dirs_live;	// used: live and deleted slots
+#define DIRS_GONE	((dirstat_t *) 1)				// deleted slot
+
+// FNV-1a hash of a string
+static size_t str_hash(const char *s) {
+	size_t	h = 14695981039346656037ULL;
+
+	for ( ; *s; s ++ )
+		h = (h ^ (unsigned char) *s) * 1099511628211ULL;
+	return h;
+	}
+
+// if set, the notes are passed to it instead of the notes list
+static void (*dirwalk_sink)(const note_t *note);
+static bool	dirwalk_stop;		// set to stop the walk
+static bool	dirwalk_nosub;		// do not scan the subdirectories
+
+#define COPY_BUFSZ	(256 * 1024)
+#define FILE_ERRSZ	256
+
+// errors of the file operations; the workers of the bulk operations run while
+// ncurses owns the screen, they keep the first error of the item in 'file_errbuf'
+static __thread char *file_errbuf;
+static void file_error(const char *file, const char *extra) {
+	int err = errno;
+
+	if ( file_errbuf ) {
+		if ( file_errbuf[0] == '\0' )
+			snprintf(file_errbuf, FILE_ERRSZ, "%s: %s%s", file, strerror(err), extra);
+		}
+	else
+		fprintf(stderr, "%s: errno %d: %s%s\n", file, err, strerror(err), extra);
+	errno = err;
+	}
+#define PRINT_AHEAD	4			// notes to read ahead in --print --all
+
+// copy the rest of the file 'ifd' to 'ofd' (from their current offsets);
+// tries splice() if 'ifd' is a pipe, copy_file_range() (in-kernel, reflink on
+// some filesystems), then sendfile() and finally read/write with a large buffer.
+bool copy_fd(int ifd, int ofd) {
+	ssize_t	bytes, w;
+	char	*buf, *p;
+	struct stat st;
+
+	// in-kernel move of the pipe's pages
+	if ( fstat(ifd, &st) == 0 && S_ISFIFO(st.st_mode) ) {
+		while ( (bytes = splice(ifd, NULL, ofd, NULL, COPY_BUFSZ * 4, SPLICE_F_MOVE | SPLICE_F_MORE)) > 0 );
+		if ( bytes == 0 )
+			return true;
+		if ( errno != EINVAL && errno != ENOSYS )
+			return false;
+		goto rwcopy; // nothing else works with pipes
+		}
+
+	// in-kernel copy between files
+	while ( (bytes = copy_file_range(ifd, NULL, ofd, NULL, COPY_BUFSZ * 16, 0)) > 0 );
+	if ( bytes == 0 )
+		return true;
+	if ( errno != EXDEV && errno != EINVAL && errno != ENOSYS && errno != EOPNOTSUPP && errno != EBADF )
+		return false;
+
+	// in-kernel copy from file
+	while ( (bytes = sendfile(ofd, ifd, NULL, COPY_BUFSZ * 16)) > 0 );
+	if ( bytes == 0 )
+		return true;
+	if ( errno != EINVAL && errno != ENOSYS )
+		return false;
+
+	// user-space copy
+rwcopy:
+	buf = (char *) malloc(COPY_BUFSZ);
+	while ( (bytes = read(ifd, buf, COPY_BUFSZ)) != 0 ) {
+		if ( bytes < 0 ) {
+			if ( errno == EINTR ) continue;
+			break;
+			}
+		for ( p = buf; bytes > 0; p += w, bytes -= w ) {
+			if ( (w = write(ofd, p, bytes)) < 0 ) {
+				if ( errno == EINTR ) { w = 0; continue; }
+				break;
+				}
+			}
+		if ( bytes > 0 )
+			break;
+		}
+	free(buf);
+	return (bytes == 0);
+	}
+
+// write all 'n' bytes of 'p'
+static bool write_all(int fd, const char *p, size_t n) {
+	ssize_t w;
 	
-//	logf = fopen("/tmp/notes.log", "a");
-//	fprintf(logf, "copy_file(\"%s\", \"%s\")\n", src, trg);
+	for ( ; n > 0; p += w, n -= w ) {
+		if ( (w = write(fd, p, n)) < 0 ) {
+			if ( errno == EINTR ) { w = 0; continue; }
+			return false;
+			}
+		}
+	return true;
+	}
+
+// exclusive lock of the note for one record at its end
+static void append_begin(int fd) {
+	while ( flock(fd, LOCK_EX) != 0 && errno == EINTR );
+	lseek(fd, 0, SEEK_END);
+	}
+static void append_end(int fd) {
+	int err = errno;
+	flock(fd, LOCK_UN);
+	errno = err;
+	}
+
+#define APPEND_RECMAX	(COPY_BUFSZ * 16)	// longest line buffered by append_fd()
+
+// append the rest of 'ifd' to 'ofd' under an exclusive lock, one record at a time, so
+// the records of concurrent appenders do not interleave. A regular file is one record,
+// copied as in copy_fd(). From a pipe, a terminal or a socket the records are lines: the
+// lock is taken when a line is complete and is not held while waiting for input, so a
+// pipe that stays open (tail -f) blocks no one; a line longer than APPEND_RECMAX is
+// written as it arrives and keeps the lock until its end.
+bool append_fd(int ifd, int ofd) {
+	ssize_t	bytes;
+	size_t	len = 0, n;
+	char	*buf, *nl;
+	bool	ok = true, locked = false;
+	struct stat st;
+
+	if ( fstat(ifd, &st) == 0 && S_ISREG(st.st_mode) ) {
+		append_begin(ofd);
+		ok = copy_fd(ifd, ofd);
+		append_end(ofd);
+		return ok;
+		}
+
+	buf = (char *) malloc(APPEND_RECMAX);
+	while ( ok ) {
+		if ( (bytes = read(ifd, buf + len, APPEND_RECMAX - len)) < 0 ) {
+			if ( errno == EINTR ) continue;
+			break;
+			}
+		len += bytes;
+		if ( bytes == 0 )	// eof, the rest is the last record
+			n = len;
+		else if ( (nl = (char *) memrchr(buf, '\n', len)) != NULL )
+			n = nl - buf + 1;
+		else if ( locked || len == APPEND_RECMAX )
+			n = len;
+		else
+			continue;	// wait for the end of the line
+		if ( n ) {
+			if ( !locked )
+				append_begin(ofd);
+			ok = write_all(ofd, buf, n);
+			locked = ( ok && bytes > 0 && buf[n - 1] != '\n' );
+			if ( !locked )
+				append_end(ofd);
+			memmove(buf, buf + n, len - n);
+			len -= n;
+			}
+		if ( bytes == 0 )
+			break;
+		}
+	if ( locked )
+		append_end(ofd);
+	free(buf);
+	return ok && (bytes == 0);
+	}
+
+// copy file; the mode and the modification time of 'src' are preserved
+bool copy_file(const char *src, const char *trg) {
+	char	*p;
+	int		ifd, ofd, err;
+	bool	rv;
+	struct stat st;
 	
-	if ( (inp = fopen(src, "r")) == NULL ) {
-		fprintf(logf, "%s: errno %d: %s\n", src, errno, strerror(errno));
+	if ( (ifd = open(src, O_RDONLY | O_CLOEXEC)) < 0 || fstat(ifd, &st) != 0 ) {
+		file_error(src, "");
+		if ( ifd >= 0 ) close(ifd);
 		return false;
 		}
 	if ( (p = strrchr(trg, '/')) != NULL ) {
@@ -513,73 +1091,350 @@ bool copy_file(const char *src, const char *trg) {
 		dd[p - trg] = '\0';
 		if ( access(dd, W_OK) != 0 ) { // new section ?
 			if ( mkdir(dd, 0755) != 0 ) {
-				fprintf(logf, "%s: errno %d: %s (mkdir [%s])\n", trg, errno, strerror(errno), dd);
-				fclose(inp);
+				file_error(dd, " (mkdir)");
+				err = errno;
+				close(ifd);
 				free(dd);
+				errno = err;
 				return false;
 				}
 			}
 		free(dd);
 		}
-	if ( (outp = fopen(trg, "w")) == NULL ) {
-		fprintf(logf, "%s: errno %d: %s\n", trg, errno, strerror(errno));
-		fclose(inp);
+	if ( (ofd = open(trg, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600)) < 0 ) {
+		file_error(trg, "");
+		err = errno;
+		close(ifd);
+		errno = err;
 		return false;
 		}
 	
-	// copy
-	while ( !feof(inp) ) {
-		if ( (bytes = fread(buf, 1, sizeof(buf), inp)) > 0 )
-			fwrite(buf, 1, bytes, outp);
-		}
+	// copy; reflink shares the data blocks (btrfs, xfs)
+#if defined(FICLONE)
+	rv = ( ioctl(ofd, FICLONE, ifd) == 0 );
+	if ( !rv )
+#endif
+		rv = copy_fd(ifd, ofd);
+	err = ( rv ) ? 0 : errno;
+	if ( !rv )
+		file_error(trg, "");
+	
+	// attributes
+	fchmod(ofd, st.st_mode & 07777);
+	struct timespec times[2] = { st.st_atim, st.st_mtim };
+	futimens(ofd, times);
 	
 	// close
-	fclose(outp);
-	fclose(inp);
-	return true;
+	if ( close(ofd) != 0 && rv ) {
+		file_error(trg, "");
+		err = errno;
+		rv = false;
+		}
+	close(ifd);
+	if ( !rv )
+		errno = err;
+	return rv;
+	}
+
+// move the file 'src' to 'trg'; an existing 'trg' is replaced only if 'replace' is set.
+// In the same filesystem it is just a rename, across filesystems the file is copied and
+// removed. Returns 0 or the errno.
+int move_file(const char *src, const char *trg, bool replace) {
+	if ( replace ) {
+		if ( rename(src, trg) == 0 )
+			return 0;
+		}
+	else {
+		if ( renameat2(AT_FDCWD, src, AT_FDCWD, trg, RENAME_NOREPLACE) == 0 )
+			return 0;
+		if ( errno == EINVAL || errno == ENOSYS ) { // not supported by the filesystem
+			if ( link(src, trg) == 0 ) // fails if trg exists
+				return ( unlink(src) == 0 ) ? 0 : errno;
+			if ( errno == EEXIST )
+				return EEXIST;
+			if ( access(trg, F_OK) == 0 )
+				return EEXIST;
+			if ( rename(src, trg) == 0 )
+				return 0;
+			}
+		}
+	if ( errno != EXDEV )
+		return errno;
+	
+	// different filesystem
+	if ( !replace && access(trg, F_OK) == 0 )
+		return EEXIST;
+	if ( !copy_file(src, trg) )
+		return errno;
+	return ( remove(src) == 0 ) ? 0 : errno;
+	}
+
+// === backup store ===
+// The backups are stored by content in 'bdir/objects/xx/yyy...', where xxyyy... is the
+// SHA-256 of the file, so identical contents are stored once. Each backup appends the
+// line "time<TAB>hash<TAB>file" to 'bdir/history'; 'file' is relative to the notebook.
+typedef struct { time_t time; char hash[SHA256_HEXSIZE+1]; char file[PATH_MAX]; } bhist_t;
+
+// the hash of the contents of the file
+bool hash_file(const char *file, char *hex) {
+	sha256_t ctx;
+	uint8_t	digest[SHA256_SIZE];
+	char	*buf;
+	ssize_t	bytes;
+	int		fd;
+	
+	if ( (fd = open(file, O_RDONLY | O_CLOEXEC)) < 0 )
+		return false;
+	buf = (char *) malloc(COPY_BUFSZ);
+	sha256_init(&ctx);
+	while ( (bytes = read(fd, buf, COPY_BUFSZ)) > 0 )
+		sha256_update(&ctx, buf, bytes);
+	sha256_final(&ctx, digest);
+	sha256_hex(digest, hex);
+	free(buf);
+	close(fd);
+	return (bytes == 0);
+	}
+
+// the filename of the object 'hash' in the store
+char *bstore_object(const char *hash, char *path) {
+	snprintf(path, PATH_MAX, "%s/objects/%.2s/%s", bdir, hash, hash + 2);
+	return path;
+	}
+
+// store the contents of 'file'; nothing is written if the object exists
+bool bstore_put(const char *file, const char *hash) {
+	char	obj[PATH_MAX], tmp[PATH_MAX];
+
+	bstore_object(hash, obj);
+	if ( access(obj, F_OK) == 0 )
+		return true;
+	snprintf(tmp, PATH_MAX, "%s/objects", bdir);
+	mkdir(tmp, 0700);
+	snprintf(tmp, PATH_MAX, "%s/objects/%.2s", bdir, hash);
+	mkdir(tmp, 0700);
+	static int seq = 0;
+	snprintf(tmp, PATH_MAX, "%s.%d.%d", obj, (int) getpid(), __atomic_fetch_add(&seq, 1, __ATOMIC_RELAXED));
+	if ( copy_file(file, tmp) && rename(tmp, obj) == 0 )
+		return true;
+	unlink(tmp);
+	return false;
+	}
+
+// append a record to the history
+bool bstore_log(const char *file, const char *hash) {
+	char	hist[PATH_MAX], line[PATH_MAX + 128];
+	size_t	root_dir_len = strlen(ndir) + 1;
+	int		fd, len;
+	bool	rv;
+
+	if ( strncmp(file, ndir, root_dir_len - 1) == 0 && file[root_dir_len - 1] == '/' )
+		file += root_dir_len;
+	snprintf(hist, PATH_MAX, "%s/history", bdir);
+	if ( (fd = open(hist, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0600)) < 0 ) {
+		file_error(hist, "");
+		return false;
+		}
+	len = snprintf(line, sizeof(line), "%ld\t%s\t%s\n", (long) time(NULL), hash, file);
+	rv = ( write(fd, line, len) == len );
+	close(fd);
+	return rv;
 	}
 
 // backup note-file
 bool note_backup(const note_t *note) {
-	char	bckf[PATH_MAX];
+	char	hash[SHA256_HEXSIZE+1];
 
 	if ( strlen(bdir) ) {
-		if ( strlen(note->section) )
-			snprintf(bckf, PATH_MAX, "%s/%s/%s", bdir, note->section, note->name);
+		if ( access(bdir, W_OK) != 0 )
+			mkdir(bdir, 0700);
+		if ( !hash_file(note->file, hash) ) {
+			file_error(note->file, "");
+			return false;
+			}
+		return bstore_put(note->file, hash) && bstore_log(note->file, hash);
+		}
+	return true;
+	}
+
+// fingerprint of a note before editing, to detect if the editor changed it
+typedef struct {
+	bool	exists;
+	off_t	size;
+	struct timespec mtime;
+	char	hash[SHA256_HEXSIZE+1];	// only if backups are enabled
+	} fprint_t;
+
+// take the fingerprint of the note before the editor runs; if backups are enabled
+// the contents are stored (if not already), but recorded only if they change
+void note_edit_begin(const note_t *note, fprint_t *fp) {
+	struct stat st;
+
+	memset(fp, 0, sizeof(fprint_t));
+	if ( stat(note->file, &st) != 0 )
+		return;
+	fp->exists = true;
+	fp->size = st.st_size;
+	fp->mtime = st.st_mtim;
+	if ( strlen(bdir) ) {
+		if ( access(bdir, W_OK) != 0 )
+			mkdir(bdir, 0700);
+		if ( hash_file(note->file, fp->hash) )
+			bstore_put(note->file, fp->hash);
 		else
-			snprintf(bckf, PATH_MAX, "%s/%s", bdir, note->name);
-		return copy_file(note->file, bckf);
+			fp->hash[0] = '\0';
+		}
+	}
+
+// compare the note with its fingerprint after the editor returns;
+// records the backup and updates note->st if it was changed; returns true if changed
+bool note_edit_end(note_t *note, const fprint_t *fp) {
+	struct stat st;
+	char	hash[SHA256_HEXSIZE+1];
+
+	if ( stat(note->file, &st) != 0 )
+		return fp->exists;
+	if ( fp->exists && st.st_size == fp->size
+			&& st.st_mtim.tv_sec == fp->mtime.tv_sec && st.st_mtim.tv_nsec == fp->mtime.tv_nsec )
+		return false;
+	note->st = st;
+	if ( fp->exists && fp->hash[0] ) {
+		if ( st.st_size == fp->size && hash_file(note->file, hash) && strcmp(hash, fp->hash) == 0 )
+			return false;	// saved without changes
+		bstore_log(note->file, fp->hash);
 		}
 	return true;
 	}
 
+// returns the list (bhist_t) of backups of the notes that match the pattern
+list_t *bstore_history(const char *pattern, const char *section) {
+	list_t	*list = list_create();
+	char	hist[PATH_MAX], buf[PATH_MAX + 128], name[PATH_MAX], *p, *e;
+	bhist_t	rec;
+	FILE	*fp;
+	
+	snprintf(hist, PATH_MAX, "%s/history", bdir);
+	if ( (fp = fopen(hist, "r")) == NULL )
+		return list;
+	while ( fgets(buf, sizeof(buf), fp) ) {
+		rtrim(buf);
+		rec.time = strtol(buf, &p, 10);
+		if ( *p != '\t' || strlen(p + 1) < SHA256_HEXSIZE + 2 || p[SHA256_HEXSIZE + 1] != '\t' )
+			continue; // invalid record
+		if ( strlen(p + SHA256_HEXSIZE + 2) >= sizeof(rec.file) )
+			continue; // the path is too long
+		memcpy(rec.hash, p + 1, SHA256_HEXSIZE);
+		rec.hash[SHA256_HEXSIZE] = '\0';
+		strcpy(rec.file, p + SHA256_HEXSIZE + 2);
+		
+		// split section / name
+		p = strrchr(rec.file, '/');
+		strcpy(name, (p) ? p + 1 : rec.file);
+		if ( (e = strrchr(name, '.')) != NULL )
+			*e = '\0';
+		if ( section ) {
+			size_t len = (p) ? p - rec.file : 0;
+			if ( strlen(section) != len || strncmp(section, rec.file, len) != 0 )
+				continue;
+			}
+		if ( fnmatch(pattern, name, FNM_PERIOD | FNM_CASEFOLD | FNM_GLIBC_EXTRA) == 0 )
+			list_add(list, &rec, sizeof(bhist_t));
+		}
+	fclose(fp);
+	return list;
+	}
+
 // prints information about the note
 void note_pl(const note_t *note) {
-	if ( opt_flags & OPT_FILES )
-		printf("%s\n", note->file);
-	else {
-		size_t	seclen = 0;
-		for ( list_node_t *cur = sections->head; cur; cur = cur->next )
-			seclen = MAX(seclen, strlen((const char *) cur->data));
-		printf("%-*s (%-3s) - %s\n", seclen, note->section, note->ftype, note->name);
+	switch ( pl_format ) {
+	case PL_JSON:
+		fputs("{\"section\":", stdout);	json_puts(note->section);
+		fputs(",\"name\":", stdout);		json_puts(note->name);
+		fputs(",\"type\":", stdout);		json_puts(note->ftype);
+		fputs(",\"file\":", stdout);		json_puts(note->file);
+		fputs("}\n", stdout);
+		break;
+	case PL_TSV:
+		tsv_puts(note->section);	putchar('\t');
+		tsv_puts(note->name);		putchar('\t');
+		tsv_puts(note->ftype);		putchar('\t');
+		tsv_puts(note->file);		putchar('\n');
+		break;
+	case PL_NUL:
+		fputs(note->file, stdout);
+		putchar('\0');
+		break;
+	default:
+		if ( opt_flags & OPT_FILES )
+			printf("%s\n", note->file);
+		else
+			printf("%-*s (%-3s) - %s\n", (int) pl_seclen, note->section, note->ftype, note->name);
 		}
 	}
 
-// simple print (mode --print) of a note
+// compute the width of the section column of note_pl() from the sections list
+void note_pl_width() {
+	pl_seclen = 0;
+	for ( list_node_t *cur = sections->head; cur; cur = cur->next )
+		pl_seclen = MAX(pl_seclen, strlen((const char *) cur->data));
+	}
+
+// dirwalk sinks of the command-line modes; the notes that match the pattern
+// (and the section) are printed or collected while walking, the walk stops
+// when 'pl_limit' notes are found
+static const char *pl_pattern, *pl_section;
+static size_t	pl_count, pl_limit;
+static bool note_pl_matches(const note_t *note) {
+	if ( pl_section && strcmp(pl_section, note->section) != 0 )
+		return false;
+	if ( fnmatch(pl_pattern, note->name, FNM_PERIOD | FNM_CASEFOLD | FNM_GLIBC_EXTRA) != 0 )
+		return false;
+	if ( ++ pl_count == pl_limit )
+		dirwalk_stop = true;
+	return true;
+	}
+
+// prints the notes that match
+static void note_pl_match(const note_t *note) {
+	if ( note_pl_matches(note) )
+		note_pl(note);
+	}
+
+// adds the notes that match to the notes list
+static void note_add_match(const note_t *note) {
+	if ( list_findstr(sections, note->section) == NULL )
+		list_addstr(sections, note->section);
+	if ( note_pl_matches(note) )
+		list_add(notes, (void *) note, sizeof(note_t));
+	}
+
+// simple print (mode --print) of a note;
+// the contents are sent to stdout by the kernel (sendfile) when possible
 void note_print(const note_t *note) {
-	FILE *fp;
-	char buf[LINE_MAX];
+	int		fd;
 	
 	printf("=== %s ===\n", note->name);
-	if ( (fp = fopen(note->file, "rt")) != NULL ) {
-		while ( fgets(buf, LINE_MAX, fp) )
-			printf("%s", buf);
-		fclose(fp);
+	fflush(stdout);
+	if ( (fd = open(note->file, O_RDONLY | O_CLOEXEC)) >= 0 ) {
+		posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+		if ( !copy_fd(fd, STDOUT_FILENO) && errno != EPIPE )
+			fprintf(stderr, "errno %d: %s\n", errno, strerror(errno));
+		close(fd);
 		}
 	else
 		fprintf(stderr, "errno %d: %s\n", errno, strerror(errno));
 	}
 
+// ask the kernel to start reading the note in background
+void note_readahead(const note_t *note) {
+	int		fd;
+	
+	if ( (fd = open(note->file, O_RDONLY | O_CLOEXEC)) >= 0 ) {
+		posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+		close(fd);
+		}
+	}
+
 // delete a note
 bool note_delete(const note_t *note) {
 	note_backup(note);
@@ -599,65 +1454,188 @@ bool dirwalk_checkfn(const char *fn) {
 	return true;
 	}
 
-// walk throu subdirs to collect notes
-void dirwalk(const char *name) {
-	DIR *dir;
-	struct dirent *entry;
-    char path[PATH_MAX];
-	size_t root_dir_len = strlen(ndir) + 1;
+// add the file 'path' to the notes list, if it passes the filter
+void dirwalk_addfile(const char *path) {
+	note_t	note;
+	char	buf[PATH_MAX], *p, *e;
+	size_t	root_dir_len = strlen(ndir) + 1;
 
-	if ( !(dir = opendir(name)) )	return;
-	while ( (entry = readdir(dir)) != NULL ) {
-		if ( !dirwalk_checkfn(entry->d_name) )
-			continue;
-		snprintf(path, sizeof(path), "%s/%s", name, entry->d_name);
-		if ( entry->d_type == DT_DIR ) 
-			dirwalk(path);
+	strcpy(note.file, path);
+	strcpy(buf, path + root_dir_len);
+	if ( (e = strrchr(buf, '.')) != NULL ) {
+		*e = '\0';
+		strcpy(note.ftype, e + 1);
+		}
+	else
+		note.ftype[0] = '\0';
+	if ( (p = strrchr(buf, '/')) != NULL ) {
+		*p = '\0';
+		strcpy(note.section, buf);
+		strcpy(note.name, p + 1);
+		}
+	else {
+		note.section[0] = '\0';
+		strcpy(note.name, buf);
+		}
+	if ( strlen(current_filter) == 0 || fnmatch(current_filter, note.name, FNM_PATHNAME | FNM_PERIOD | FNM_GLIBC_EXTRA | FNM_CASEFOLD) == 0 ) {
+		stat(note.file, &note.st);
+		if ( dirwalk_sink )
+			dirwalk_sink(&note);
 		else {
-			note_t *note = (note_t *) malloc(sizeof(note_t));
-			char	buf[PATH_MAX], *p, *e;
-			strcpy(note->file, path);
-			strcpy(buf, path + root_dir_len);
-			if ( (e = strrchr(buf, '.')) != NULL ) {
-				*e = '\0';
-				strcpy(note->ftype, e + 1);
-				}
-			if ( (p = strrchr(buf, '/')) != NULL ) {
-				*p = '\0';
-				strcpy(note->section, buf);
-				strcpy(note->name, p + 1);
-				}
-			else {
-				note->section[0] = '\0';
-				strcpy(note->name, buf);
-				}
-			if ( strlen(current_filter) == 0 || fnmatch(current_filter, note->name, FNM_PATHNAME | FNM_PERIOD | FNM_GLIBC_EXTRA | FNM_CASEFOLD) == 0 ) {
-				stat(note->file, &note->st);
-				list_add(notes, note, sizeof(note_t));
-				if ( list_findstr(sections, note->section) == NULL )
-					list_addstr(sections, note->section);
-				}
-			else
-				free(note);
+			list_add(notes, &note, sizeof(note_t));
+			if ( list_findstr(sections, note.section) == NULL )
+				list_addstr(sections, note.section);
+			}
+		}
+	}
+
+// the slot of 'path' in dirs_index, either its own or the empty one to store it
+static dirstat_t **dirs_slot(const char *path) {
+	size_t	mask = dirs_slots - 1, h = str_hash(path) & mask;
+
+	for ( ; dirs_index[h]; h = (h + 1) & mask )
+		if ( dirs_index[h] != DIRS_GONE && strcmp(dirs_index[h]->path, path) == 0 )
+			break;
+	return &dirs_index[h];
+	}
+
+// returns the scanned directory 'path' or NULL
+dirstat_t *dirs_find(const char *path) {
+	return ( dirs_slots ) ? *dirs_slot(path) : NULL;
+	}
+
+// adds the directory 'path' (not in the list)
+static dirstat_t *dirs_add(const char *path) {
+	dirstat_t *ds;
+
+	if ( (dirs_used + 1) * 4 > dirs_slots * 3 ) { // rehash without the deleted slots, double if needed
+		dirstat_t **old = dirs_index;
+		size_t	n = dirs_slots;
+		if ( n == 0 )
+			dirs_slots = 256;
+		else if ( (dirs_live + 1) * 2 > n )
+			dirs_slots = n << 1;
+		dirs_index = (dirstat_t **) calloc(dirs_slots, sizeof(dirstat_t *));
+		for ( size_t i = 0; i < n; i ++ )
+			if ( old[i] && old[i] != DIRS_GONE )
+				*dirs_slot(old[i]->path) = old[i];
+		free(old);
+		dirs_used = dirs_live;
+		}
+	ds = (dirstat_t *) list_add(dirs, NULL, sizeof(dirstat_t))->data;
+	strcpy(ds->path, path);
+	ds->wd = -1;
+	*dirs_slot(path) = ds;
+	dirs_used ++;
+	dirs_live ++;
+	return ds;
+	}
+
+// removes the directory of the list node
+static void dirs_delete(list_node_t *node) {
+	*dirs_slot(((dirstat_t *) node->data)->path) = DIRS_GONE;
+	dirs_live --;
+	list_delete(dirs, node);
+	}
+
+// removes all the directories
+void dirs_clear() {
+	list_clear(dirs);
+	if ( dirs_index )
+		memset(dirs_index, 0, sizeof(dirstat_t *) * dirs_slots);
+	dirs_used = dirs_live = 0;
+	}
+
+// scan the directory 'name' to collect notes;
+// subdirectories are scanned if 'recursive' is set or if they are not scanned before
+void dirscan(const char *name, bool recursive) {
+	DIR *dir;
+	struct dirent *entry;
+	struct stat st;
+	dirstat_t *ds;
+	char path[PATH_MAX];
+
+	if ( !(dir = opendir(name)) )	return;
+	if ( fstat(dirfd(dir), &st) == 0 ) {
+		if ( (ds = dirs_find(name)) == NULL )
+			ds = dirs_add(name);
+		ds->mtime = st.st_mtim;
+		}
+	while ( !dirwalk_stop && (entry = readdir(dir)) != NULL ) {
+		if ( !dirwalk_checkfn(entry->d_name) )
+			continue;
+		snprintf(path, sizeof(path), "%s/%s", name, entry->d_name);
+		if ( entry->d_type == DT_DIR ) {
+			if ( !dirwalk_nosub && (recursive || dirs_find(path) == NULL) )
+				dirscan(path, true);
 			}
+		else
+			dirwalk_addfile(path);
 		}
 	closedir(dir);
 	}
 
-// copy contents of file to output
-bool print_file_to(const char *file, FILE *output) {
-	FILE	*input;
-	char	buf[LINE_MAX];
-	size_t	bytes;
+// walk throu subdirs to collect notes
+void dirwalk(const char *name) {
+	dirscan(name, true);
+	}
+
+// predicate for list_delete_if(), true if the note is in the directory 'arg'
+static void (*dirwalk_onremove)(note_t *);
+static bool note_indir(void *data, void *arg) {
+	note_t	*note = (note_t *) data;
+	const char *dir = (const char *) arg;
+	size_t	len = strlen(dir);
 	
-	if ( (input = (file) ? fopen(file, "r") : stdin) != NULL ) {	
-		while ( !feof(input) ) {
-			if ( (bytes = fread(buf, 1, sizeof(buf), input)) > 0 )
-				fwrite(buf, 1, bytes, output);
-			}
-		if ( file ) fclose(input);
+	if ( strncmp(note->file, dir, len) == 0 && note->file[len] == '/' && strchr(note->file + len + 1, '/') == NULL ) {
+		if ( dirwalk_onremove )
+			dirwalk_onremove(note);
 		return true;
 		}
+	return false;
+	}
+
+// rescan only the directories that modified since the last scan;
+// 'onremove' (if any) is called for each note before it is removed from the list;
+// returns the number of the modified directories
+int dirwalk_update(void (*onremove)(note_t *)) {
+	list_node_t	*cur, *next;
+	dirstat_t	*ds;
+	struct stat	st;
+	int		count = 0;
+
+	dirwalk_onremove = onremove;
+	for ( cur = dirs->head; cur; cur = next ) {
+		next = cur->next;
+		ds = (dirstat_t *) cur->data;
+		if ( stat(ds->path, &st) != 0 ) { // removed
+			list_delete_if(notes, note_indir, ds->path);
+			dirs_delete(cur);
+			count ++;
+			}
+		else if ( st.st_mtim.tv_sec != ds->mtime.tv_sec || st.st_mtim.tv_nsec != ds->mtime.tv_nsec ) {
+			list_delete_if(notes, note_indir, ds->path);
+			dirscan(ds->path, false);
+			next = cur->next; // new directories may be added
+			count ++;
+			}
+		}
+	dirwalk_onremove = NULL;
+	return count;
+	}
+
+// copy contents of file (or stdin if NULL) to output; with 'lock', output is
+// locked for each record (append_fd)
+bool print_file_to(const char *file, int output, bool lock) {
+	int		input;
+	bool	rv;
+	
+	if ( (input = (file) ? open(file, O_RDONLY | O_CLOEXEC) : STDIN_FILENO) >= 0 ) {
+		if ( !(rv = (lock) ? append_fd(input, output) : copy_fd(input, output)) )
+			fprintf(stderr, "%s: errno %d: %s\n", (file) ? file : "stdin", errno, strerror(errno));
+		if ( file ) close(input);
+		return rv;
+		}
 	else 
 		fprintf(stderr, "%s: errno %d: %s\n", file, errno, strerror(errno));
 	return false;
@@ -689,6 +1667,23 @@ void normalize_section_name(char *section) {
 		}
 	}
 
+// creates the directory 'dir' and its parents, as mkdir -p; returns 0 or the errno
+int make_dirs(const char *dir) {
+	char	path[PATH_MAX], *p;
+
+	if ( strlen(dir) >= PATH_MAX )
+		return ENAMETOOLONG;
+	strcpy(path, dir);
+	for ( p = strchr(path + 1, '/'); ; p = strchr(p + 1, '/') ) {
+		if ( p ) *p = '\0';
+		if ( mkdir(path, 0700) != 0 && errno != EEXIST )
+			return errno;
+		if ( !p ) break;
+		*p = '/';
+		}
+	return 0;
+	}
+
 // if section does not exists, creates it
 void make_section(const char *sec) {
 	char dest[PATH_MAX];
@@ -704,7 +1699,8 @@ void make_section(const char *sec) {
 		}
 	}
 
-// create a note node
+// create a note node; flags: 0x01 create the file, 0x02 only resolve the path
+// (the section is not created)
 note_t*	make_note(const char *name, const char *defsec, int flags) {
 	note_t *note = (note_t *) malloc(sizeof(note_t));
 	FILE *fp;
@@ -715,7 +1711,8 @@ note_t*	make_note(const char *name, const char *defsec, int flags) {
 		strncpy(note->section, name, p - name);
 		note->section[p - name] = '\0';
 		normalize_section_name(note->section);
-		make_section(note->section);
+		if ( !(flags & 0x02) )
+			make_section(note->section);
 		snprintf(note->file, PATH_MAX, "%s/%s/%s", ndir, note->section, note->name);
 		}
 	else {
@@ -723,7 +1720,8 @@ note_t*	make_note(const char *name, const char *defsec, int flags) {
 		if ( defsec && strlen(defsec) ) {
 			strcpy(note->section, defsec);
 			normalize_section_name(note->section);
-			make_section(note->section);
+			if ( !(flags & 0x02) )
+				make_section(note->section);
 			snprintf(note->file, PATH_MAX, "%s/%s/%s", ndir, note->section, note->name);
 			}
 		else {
@@ -753,6 +1751,378 @@ note_t*	make_note(const char *name, const char *defsec, int flags) {
 	return note;
 	}
 
+// === sniffing =============================================================
+
+// The preview displays only text notes of reasonable size; the others get a
+// summary. The first SNIFF_SIZE bytes are enough to tell: a magic number, or
+// NULs and control bytes, make a file binary. A short magic number that is
+// plain text ("ID3", "BZh") needs a control byte in the block too.
+//
+// The notes are recreated by every rebuild of the catalog (each search key,
+// F5, rename), so the results are kept by filename in 'sniff_cache' and
+// checked against the version of the file.
+
+#define SNIFF_SIZE	4096
+#define SNIFF_MAX	(16 * 1024 * 1024)	// default preview_max
+
+typedef struct { const char *magic; size_t len, off; const char *desc; } magic_t;
+static const magic_t magics[] = {
+	{ "%PDF-", 5, 0, "PDF document" },
+	{ "\x89PNG\r\n\x1A\n", 8, 0, "PNG image" },
+	{ "\xFF\xD8\xFF", 3, 0, "JPEG image" },
+	{ "GIF87a", 6, 0, "GIF image" },
+	{ "GIF89a", 6, 0, "GIF image" },
+	{ "RIFF", 4, 0, "RIFF data (WAV, AVI, WebP)" },
+	{ "ftyp", 4, 4, "ISO media (MP4, MOV, HEIC)" },
+	{ "OggS", 4, 0, "Ogg media" },
+	{ "fLaC", 4, 0, "FLAC audio" },
+	{ "ID3", 3, 0, "MP3 audio" },
+	{ "PK\x03\x04", 4, 0, "Zip archive (ODF, DOCX, EPUB, JAR)" },
+	{ "\x1F\x8B", 2, 0, "gzip compressed data" },
+	{ "BZh", 3, 0, "bzip2 compressed data" },
+	{ "\xFD" "7zXZ", 6, 0, "xz compressed data" },
+	{ "\x28\xB5\x2F\xFD", 4, 0, "zstd compressed data" },
+	{ "7z\xBC\xAF\x27\x1C", 6, 0, "7-Zip archive" },
+	{ "Rar!\x1A\x07", 6, 0, "RAR archive" },
+	{ "ustar", 5, 257, "tar archive" },
+	{ "\x7F" "ELF", 4, 0, "ELF executable" },
+	{ "SQLite format 3", 16, 0, "SQLite database" },
+	{ "\xD0\xCF\x11\xE0\xA1\xB1\x1A\xE1", 8, 0, "MS Office document" },
+	{ NULL, 0, 0, NULL } };
+
+// returns the size limit of the preview (preview_max: bytes, or with K, M, G);
+// SNIFF_MAX if it is not set, not a number or not positive
+static off_t sniff_max() {
+	char	*e;
+	off_t	n;
+
+	n = strtoll(preview_max, &e, 10);
+	if ( e == preview_max || n <= 0 )
+		return SNIFF_MAX;
+	switch ( toupper(*e) ) {
+	case 'G': n <<= 10; // fall through
+	case 'M': n <<= 10; // fall through
+	case 'K': n <<= 10;
+		}
+	return n;
+	}
+
+// filename -> sniff_t; open addressing, power of 2, kept under 3/4 full
+typedef struct { char *file; sniff_t sniff; } sniff_slot_t;
+static sniff_slot_t *sniff_cache;
+static size_t	sniff_slots, sniff_count;
+
+// the slot of 'file' in sniff_cache, either its own or the empty one to store it
+static sniff_slot_t *sniff_slot(const char *file) {
+	size_t	h = str_hash(file), mask = sniff_slots - 1;
+
+	for ( h &= mask; sniff_cache[h].file; h = (h + 1) & mask )
+		if ( strcmp(sniff_cache[h].file, file) == 0 )
+			break;
+	return &sniff_cache[h];
+	}
+
+// the cached classification of 'file', a new one (SNIFF_NONE) if there is none
+static sniff_t *sniff_get(const char *file) {
+	sniff_slot_t *sl;
+
+	if ( (sniff_count + 1) * 4 > sniff_slots * 3 ) { // double and rehash
+		sniff_slot_t *old = sniff_cache;
+		size_t	n = sniff_slots;
+		sniff_slots = ( n ) ? n << 1 : 256;
+		sniff_cache = (sniff_slot_t *) calloc(sniff_slots, sizeof(sniff_slot_t));
+		for ( size_t i = 0; i < n; i ++ )
+			if ( old[i].file )
+				*sniff_slot(old[i].file) = old[i];
+		free(old);
+		}
+	if ( (sl = sniff_slot(file))->file == NULL ) {
+		sl->file = strdup(file);
+		sl->sniff.type = SNIFF_NONE;
+		sniff_count ++;
+		}
+	return &sl->sniff;
+	}
+
+// true if the magic number is short plain text, it may be the start of a note
+static bool magic_weak(const magic_t *m) {
+	if ( m->len > 4 )
+		return false;
+	for ( size_t i = 0; i < m->len; i ++ )
+		if ( m->magic[i] < 0x20 || m->magic[i] > 0x7E )
+			return false;
+	return true;
+	}
+
+// drop the cache
+void sniff_free() {
+	for ( size_t i = 0; i < sniff_slots; i ++ )
+		free(sniff_cache[i].file);
+	free(sniff_cache);
+	sniff_cache = NULL;
+	sniff_slots = sniff_count = 0;
+	}
+
+// classifies the note by its first bytes, unless it is done already for
+// this version ('st') of the file
+const sniff_t *note_sniff(const note_t *note, const struct stat *st) {
+	sniff_t	*sn = sniff_get(note->file);
+	char	buf[SNIFF_SIZE];
+	const char *p;
+	ssize_t	n;
+	size_t	ctl;
+	int		fd;
+
+	if ( sn->type != SNIFF_NONE && sn->ino == st->st_ino && sn->size == st->st_size
+			&& sn->mtim.tv_sec == st->st_mtim.tv_sec && sn->mtim.tv_nsec == st->st_mtim.tv_nsec )
+		return sn;
+	sn->type = SNIFF_TEXT;
+	sn->desc = NULL;
+	sn->lines = 0;
+	sn->ino = st->st_ino;
+	sn->size = st->st_size;
+	sn->mtim = st->st_mtim;
+	if ( (fd = open(note->file, O_RDONLY)) == -1 )
+		return sn;
+	n = read(fd, buf, sizeof(buf));
+	close(fd);
+	if ( n <= 0 )
+		return sn;
+	ctl = ctlcount(buf, n);
+	for ( int i = 0; magics[i].magic; i ++ ) {
+		const magic_t *m = &magics[i];
+		if ( m->off + m->len <= (size_t) n && memcmp(buf + m->off, m->magic, m->len) == 0
+				&& (ctl || !magic_weak(m)) ) {
+			sn->type = SNIFF_BINARY;
+			sn->desc = m->desc;
+			return sn;
+			}
+		}
+	if ( memchr(buf, '\0', n) || ctl > (size_t) n / 32 ) {
+		sn->type = SNIFF_BINARY;
+		return sn;
+		}
+	for ( p = buf; (p = memchr(p, '\n', buf + n - p)) != NULL; p ++ )
+		sn->lines ++;
+	if ( n < st->st_size ) // estimated
+		sn->lines = (double) sn->lines * st->st_size / n;
+	else if ( buf[n - 1] != '\n' )
+		sn->lines ++;
+	if ( st->st_size > sniff_max() )
+		sn->type = SNIFF_HUGE;
+	return sn;
+	}
+
+// === markdown =============================================================
+
+// The preview colours markdown one line at a time. The only state that passes
+// from a line to the next is the fenced code block, so the lexer takes and
+// returns it: 0, or the fence that opened the block (length << 1 | 1 for '~').
+
+typedef enum { MD_TEXT, MD_HEAD, MD_CODE, MD_EMPH, MD_STRONG, MD_LIST, MD_LINK, MD_URL, MD_QUOTE, MD_RULE } md_kind_t;
+typedef struct { size_t start, len; md_kind_t kind; } md_run_t;
+#define MD_RUNS	64		// runs per line; the last one takes the rest of the line
+
+// returns the length of the fence (3+ '`' or '~' after up to 3 spaces) at
+// the beginning of the line, its character in 'fc' and its end in 'end'
+static size_t md_fence(const char *p, size_t len, char *fc, size_t *end) {
+	size_t	i = 0, n;
+
+	while ( i < len && i < 3 && p[i] == ' ' ) i ++;
+	if ( i >= len || (p[i] != '`' && p[i] != '~') )
+		return 0;
+	*fc = p[i];
+	for ( n = 0; i + n < len && p[i + n] == *fc; n ++ );
+	*end = i + n;
+	if ( n < 3 || (*fc == '`' && memchr(p + *end, '`', len - *end)) )
+		return 0;
+	return n;
+	}
+
+// returns the state of the line after this one
+static int md_next(const char *p, size_t len, int state) {
+	char	fc;
+	size_t	end, n = md_fence(p, len, &fc, &end);
+
+	if ( state == 0 )
+		return ( n ) ? (MIN(n, 127) << 1) | (fc == '~') : 0;
+	if ( n && (fc == '~') == (state & 1) && n >= (size_t) (state >> 1) ) {
+		while ( end < len && isblank(p[end]) ) end ++;
+		if ( end == len )
+			return 0; // closing fence
+		}
+	return state;
+	}
+
+// adds a run; consecutive runs of the same kind are merged
+static void md_add(md_run_t *runs, int *count, size_t start, size_t len, md_kind_t kind) {
+	md_run_t *last = ( *count ) ? &runs[*count - 1] : NULL;
+
+	if ( len == 0 )
+		return;
+	if ( last && (last->kind == kind || *count == MD_RUNS) )
+		last->len = start + len - last->start;
+	else
+		runs[(*count) ++] = (md_run_t) { start, len, kind };
+	}
+
+// returns the end of the span that starts with the delimiter 'd' ('dlen'
+// bytes) at 'i', or 0 if it is not closed in this line
+static size_t md_span(const char *p, size_t len, size_t i, const char *d, size_t dlen) {
+	const char *e;
+
+	if ( i + dlen >= len || isspace(p[i + dlen]) || p[i + dlen] == *d )
+		return 0;
+	for ( size_t j = i + dlen; (e = memmem(p + j, len - j, d, dlen)) != NULL; j = e - p + 1 ) {
+		size_t	k = e - p;
+		if ( isspace(p[k - 1]) || (k + dlen < len && p[k + dlen] == *d) )
+			continue;
+		if ( *d == '_' && k + dlen < len && isalnum(p[k + dlen]) )
+			continue;
+		return k + dlen;
+		}
+	return 0;
+	}
+
+// returns true if 'p' starts with the scheme of a url, followed by something
+static bool md_scheme(const char *p, size_t len) {
+	static const char *schemes[] = { "http://", "https://", "mailto:", NULL };
+
+	for ( int i = 0; schemes[i]; i ++ ) {
+		size_t	l = strlen(schemes[i]);
+		if ( len > l && memcmp(p, schemes[i], l) == 0 )
+			return true;
+		}
+	return false;
+	}
+
+// emphasis, code spans, links and urls
+static void md_inline(const char *p, size_t len, size_t i, md_run_t *runs, int *count) {
+	size_t	text = i, end, m;
+	md_kind_t kind = MD_TEXT;
+	const char *q;
+
+	while ( i < len ) {
+		end = 0;
+		switch ( p[i] ) {
+		case '\\':
+			i += 2;
+			continue;
+		case '`':
+			for ( m = 1; i + m < len && p[i + m] == '`'; m ++ );
+			for ( size_t j = i + m; (q = memchr(p + j, '`', len - j)) != NULL; ) {
+				size_t	n;
+				for ( n = 0; q + n < p + len && q[n] == '`'; n ++ );
+				if ( n == m ) {
+					end = q - p + n;
+					break;
+					}
+				j = q - p + n;
+				}
+			kind = MD_CODE;
+			break;
+		case '*': case '_':
+			if ( p[i] == '_' && i && isalnum(p[i - 1]) )
+				break;
+			m = ( i + 1 < len && p[i + 1] == p[i] ) ? 2 : 1;
+			end = md_span(p, len, i, p + i, m);
+			kind = ( m == 2 ) ? MD_STRONG : MD_EMPH;
+			break;
+		case '[':
+			if ( (q = memchr(p + i, ']', len - i)) != NULL && q + 1 < p + len && q[1] == '(' ) {
+				const char *r = memchr(q, ')', p + len - q);
+				if ( r ) {
+					md_add(runs, count, text, i - text, MD_TEXT);
+					md_add(runs, count, i, q + 1 - (p + i), MD_LINK);
+					md_add(runs, count, q + 1 - p, r - q, MD_URL);
+					i = text = r + 1 - p;
+					continue;
+					}
+				}
+			break;
+		case '<': case 'h': case 'm':
+			if ( p[i] != '<' && i && isalnum(p[i - 1]) )
+				break;
+			m = i + (p[i] == '<');
+			if ( !md_scheme(p + m, len - m) )
+				break;
+			for ( end = m; end < len && !isspace(p[end]) && p[end] != '>'; end ++ );
+			if ( p[i] == '<' )
+				end = ( end < len && p[end] == '>' ) ? end + 1 : 0;
+			kind = MD_URL;
+			break;
+			}
+		if ( end ) {
+			md_add(runs, count, text, i - text, MD_TEXT);
+			md_add(runs, count, i, end - i, kind);
+			i = text = end;
+			}
+		else
+			i ++;
+		}
+	md_add(runs, count, text, len - text, MD_TEXT);
+	}
+
+// splits the line in runs of one kind; returns the state of the next line
+static int md_lex(const char *p, size_t len, int state, md_run_t *runs, int *count) {
+	int		next = md_next(p, len, state);
+	size_t	i = 0, col = 0, n;
+
+	*count = 0;
+	if ( state || next ) { // fences and fenced code
+		md_add(runs, count, 0, len, MD_CODE);
+		return next;
+		}
+	for ( ; i < len && isblank(p[i]); i ++ )
+		col += ( p[i] == '\t' ) ? 4 - (col & 3) : 1;
+
+	// thematic break, before the lists: "* * *"
+	if ( i < len && p[i] && strchr("-*_", p[i]) ) {
+		size_t	marks = 0;
+		for ( n = i; n < len && (p[n] == p[i] || isblank(p[n])); n ++ )
+			marks += (p[n] == p[i]);
+		if ( n == len && marks >= 3 ) {
+			md_add(runs, count, 0, len, MD_RULE);
+			return next;
+			}
+		}
+
+	// list items
+	n = i;
+	if ( i < len && p[i] && strchr("-*+", p[i]) )
+		n = i + 1;
+	else {
+		while ( n < len && n - i < 9 && isdigit(p[n]) ) n ++;
+		n = ( n > i && n < len && (p[n] == '.' || p[n] == ')') ) ? n + 1 : i;
+		}
+	if ( n > i && (n == len || isblank(p[n])) ) {
+		md_add(runs, count, 0, n, MD_LIST);
+		md_inline(p, len, n, runs, count);
+		return next;
+		}
+
+	// indented code
+	if ( col >= 4 ) {
+		md_add(runs, count, 0, len, MD_CODE);
+		return next;
+		}
+
+	// headings and quotes
+	if ( i < len && p[i] == '#' ) {
+		for ( n = i; n < len && p[n] == '#'; n ++ );
+		if ( n - i <= 6 && (n == len || isblank(p[n])) ) {
+			md_add(runs, count, 0, len, MD_HEAD);
+			return next;
+			}
+		}
+	if ( i < len && p[i] == '>' ) {
+		md_add(runs, count, 0, len, MD_QUOTE);
+		return next;
+		}
+	md_inline(p, len, 0, runs, count);
+	return next;
+	}
+
 // === explorer =============================================================
 static note_t **t_notes;
 static int	t_notes_count;
@@ -761,6 +2131,44 @@ static WINDOW	*w_lst, *w_prv, *w_inf;
 typedef enum { ex_nav, ex_search } ex_mode_t;
 static int clr_code = 0x10;
 static int clr_text = 0x10;
+static int clr_head = 0x10;
+static int clr_link = 0x10;
+
+// attributes of the markdown runs in the preview
+#ifndef A_ITALIC
+#define A_ITALIC	A_UNDERLINE
+#endif
+static const struct { int *pair; attr_t attr; } md_style[] = {
+	[MD_TEXT]	= { &clr_text, A_NORMAL },
+	[MD_HEAD]	= { &clr_head, A_BOLD },
+	[MD_CODE]	= { &clr_code, A_NORMAL },
+	[MD_EMPH]	= { &clr_text, A_ITALIC },
+	[MD_STRONG]	= { &clr_text, A_BOLD },
+	[MD_LIST]	= { &clr_head, A_BOLD },
+	[MD_LINK]	= { &clr_link, A_NORMAL },
+	[MD_URL]	= { &clr_link, A_UNDERLINE },
+	[MD_QUOTE]	= { &clr_text, A_DIM },
+	[MD_RULE]	= { &clr_text, A_DIM } };
+
+// a row of the preview: where it starts in the text and its line
+typedef struct { size_t off, line; } ex_row_t;
+
+// the note of the preview window; the file stays mapped and indexed until
+// another note is displayed or the file is modified
+static struct {
+	char	file[PATH_MAX];		// empty if nothing is loaded
+	struct stat st;
+	char	*map;
+	lindex_t li;
+	bool	md;
+	unsigned char *mds;			// markdown state at the beginning of each line
+	size_t	mds_count, mds_alloc;	// lines with known state
+	ex_row_t *rows;				// layout: the soft-wrapped rows, as far as computed
+	size_t	rows_count, rows_alloc;
+	int		width;				// the width of the layout
+	size_t	top;				// the first row displayed
+	int		height;				// rows displayed
+	} prv;
 
 // short date
 const char *sdate(const time_t *t, char *buf) {
@@ -791,21 +2199,124 @@ bool ex_input(char *buf, const char *prompt_fmt, ...) {
 	return nc_editstr(buf, getmaxx(stdscr)-4);
 	}
 
-// print status line
-void ex_status_line(const char *fmt, ...) {
-	char	msg[LINE_MAX];
-	va_list ap;
-	va_start(ap, fmt);
-	vsnprintf(msg, LINE_MAX, fmt, ap);
-	va_end(ap);
+// === background onstart ===
+static pid_t	sync_pid = 0;	// the running onstart command
+static int		sync_fd = -1;	// its output (stdout & stderr)
+static int		sync_status;	// its exit status
+static time_t	sync_time;		// start time
+static char		sync_msg[64];	// the last line of its output
+
+// run the onstart command in background; on failure returns false and
+// the error is in sync_msg
+bool ex_sync_start() {
+	sync_msg[0] = '\0';
+	sync_time = time(NULL);
+	if ( (sync_pid = sh_start(onstart_cmd, SH_PIPE, &sync_fd)) <= 0 ) {
+		if ( sync_pid < 0 )
+			snprintf(sync_msg, sizeof(sync_msg), "errno %d: %s", errno, strerror(errno));
+		sync_pid = 0;
+		sync_fd = -1;
+		return ( sync_msg[0] == '\0' );
+		}
+	return true;
+	}
+
+// read the output of the onstart command; returns true when it finishes
+bool ex_sync_poll(bool block) {
+	char	buf[LINE_MAX], *p, *e;
+	ssize_t	bytes;
+	
+	if ( sync_pid <= 0 )
+		return false;
+	if ( block ) // drain the pipe to avoid SIGPIPE to the command
+		fcntl(sync_fd, F_SETFL, 0);
+	while ( (bytes = read(sync_fd, buf, sizeof(buf) - 1)) > 0 ) {
+		buf[bytes] = '\0';
+		for ( e = buf + bytes; e > buf && isspace(e[-1]); e -- ) *(e - 1) = '\0';
+		for ( p = e; p > buf && p[-1] != '\n' && p[-1] != '\r'; p -- );
+		if ( *p ) {
+			strncpy(sync_msg, p, sizeof(sync_msg) - 1);
+			sync_msg[sizeof(sync_msg) - 1] = '\0';
+			}
+		}
+	if ( bytes == 0 || block ) { // eof
+		sync_status = sh_wait(sync_pid);
+		close(sync_fd);
+		sync_pid = 0;
+		sync_fd = -1;
+		return true;
+		}
+	return false;
+	}
+
+// the explorer draws a frame in the windows, stages them with wnoutrefresh()
+// and sends them to the terminal with one doupdate()
+static size_t	frame_bytes;	// written to the terminal by the last frame
+static size_t	frame_count;	// frames counted, only with frame_stats
+
+// sends the staged windows to the terminal
+static void ex_frame() {
+	if ( istrue(frame_stats) ) {
+		frame_bytes = nc_update(true);
+		frame_count ++;
+		}
+	else
+		nc_update(false);
+	}
+
+// the next frame repaints what an overlapping window or a subprocess left on
+// the screen; after a subprocess the contents of the terminal are unknown,
+// so all of it
+static void ex_repaint() {
+	if ( isendwin() )
+		clearok(curscr, TRUE);
+	touchwin(stdscr);
+	wnoutrefresh(stdscr);
+	}
 
+// status line: the count of notes, then the message
+static void ex_status_begin() {
 	werase(w_inf);
 	wattron(w_inf, A_REVERSE);
 	mvwhline(w_inf, 0, 0, ' ', getmaxx(w_inf));
 	// │┃
-	nc_wprintf(w_inf, "%6d ┃ %s", list_count(notes), msg);
+	nc_wprintf(w_inf, "%6d ┃ ", list_count(notes));
+	}
+
+// status line: the right side, then stage it
+static void ex_status_end() {
+	if ( sync_pid > 0 || frame_count ) { // onstart is running, frame statistics
+		int		y, x;
+		char	inf[LINE_MAX] = "";
+		
+		getyx(w_inf, y, x);
+		if ( sync_pid > 0 )
+			snprintf(inf, LINE_MAX, " ┃ sync %lds %s ", (long) (time(NULL) - sync_time), sync_msg);
+		if ( frame_count )
+			snprintf(inf + strlen(inf), LINE_MAX - strlen(inf), " ┃ %zu bytes/frame ", frame_bytes);
+		mvwprintw(w_inf, 0, MAX(getmaxx(w_inf) / 2, getmaxx(w_inf) - (int) u8width(inf)), "%s", inf);
+		wmove(w_inf, y, x);
+		}
 	wattroff(w_inf, A_REVERSE);
-	wrefresh(w_inf);
+	wnoutrefresh(w_inf);
+	}
+
+// print status line
+void ex_status_line(const char *fmt, ...) {
+	va_list ap;
+
+	ex_status_begin();
+	va_start(ap, fmt);
+	nc_vmvwprintf(w_inf, -1, -1, fmt, ap);
+	va_end(ap);
+	ex_status_end();
+	}
+
+// print precompiled text on the status line
+static void ex_status_runs(const nc_run_t *runs) {
+	ex_status_begin();
+	nc_mvwputruns(w_inf, -1, -1, runs);
+	ex_status_end();
 	}
 
 // display list of notes (list window)
@@ -830,14 +2341,205 @@ void ex_print_list(int offset, int pos) {
 		}
 	else
 		mvwprintw(w_lst, 0, 0, "* No notes found! *");
-	wrefresh(w_lst);
+	wnoutrefresh(w_lst);
+	}
+
+// unloads the preview
+static void ex_prv_free() {
+	if ( prv.file[0] ) {
+		if ( prv.map )
+			munmap(prv.map, prv.st.st_size);
+		lindex_free(&prv.li);
+		free(prv.mds);
+		free(prv.rows);
+		memset(&prv, 0, sizeof(prv));
+		}
+	}
+
+// maps the file of the note, unless it is already the preview and it is
+// not modified since ('st' is its current status); returns false if it
+// cannot be read
+static bool ex_prv_load(const note_t *note, const struct stat *st_now) {
+	struct stat st = *st_now;
+	int		fd;
+	size_t	top;
+
+	if ( prv.file[0] && strcmp(prv.file, note->file) == 0 && st.st_ino == prv.st.st_ino && st.st_size == prv.st.st_size
+			&& st.st_mtim.tv_sec == prv.st.st_mtim.tv_sec && st.st_mtim.tv_nsec == prv.st.st_mtim.tv_nsec )
+		return true;
+	// a modified file keeps its scroll position
+	top = ( strcmp(prv.file, note->file) == 0 ) ? prv.top : 0;
+	ex_prv_free();
+	if ( (fd = open(note->file, O_RDONLY)) == -1 )
+		return false;
+	if ( st.st_size && (prv.map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED ) {
+		prv.map = NULL;
+		close(fd);
+		return false;
+		}
+	close(fd);
+	strcpy(prv.file, note->file);
+	prv.st = st;
+	lindex_init(&prv.li, ( prv.map ) ? prv.map : "", st.st_size);
+	prv.md = (strcmp(note->ftype, "md") == 0);
+	prv.mds_alloc = 256;
+	prv.mds = (unsigned char *) malloc(prv.mds_alloc);
+	prv.mds[0] = 0;
+	prv.mds_count = 1;
+	prv.top = top;
+	return true;
+	}
+
+// returns the markdown state at the beginning of the line 'n' (indexed);
+// the states are computed once, on from the last known
+static int ex_prv_state(size_t n) {
+	const char *p;
+	size_t	len;
+
+	while ( prv.mds_count <= n ) {
+		if ( prv.mds_count == prv.mds_alloc ) {
+			prv.mds_alloc <<= 1;
+			prv.mds = (unsigned char *) realloc(prv.mds, prv.mds_alloc);
+			}
+		p = lindex_line(&prv.li, prv.mds_count - 1, &len);
+		prv.mds[prv.mds_count] = md_next(p, len, prv.mds[prv.mds_count - 1]);
+		prv.mds_count ++;
+		}
+	return prv.mds[n];
+	}
+
+// computes the layout up to the row 'r' for the width of the window; the lines
+// are wrapped at the last blank that fits, or at the last character if there
+// is none; returns true if the row exists
+static bool ex_prv_row(size_t r) {
+	size_t	off, line, len, n, col;
+	const char *q;
+
+	if ( prv.rows_count == 0 ) {
+		if ( !lindex_has(&prv.li, 0) )
+			return false;
+		if ( prv.rows == NULL ) {
+			prv.rows_alloc = 256;
+			prv.rows = (ex_row_t *) malloc(sizeof(ex_row_t) * prv.rows_alloc);
+			}
+		prv.rows[prv.rows_count ++] = (ex_row_t) { 0, 0 };
+		}
+	while ( prv.rows_count <= r ) {
+		off  = prv.rows[prv.rows_count - 1].off;
+		line = prv.rows[prv.rows_count - 1].line;
+		lindex_line(&prv.li, line, &len);
+		len -= off - prv.li.lines[line];
+		q = prv.li.text + off;
+		col = 0;
+		n = u8fit(q, len, &col, prv.width);
+		if ( n < len ) { // wrap
+			if ( n == 0 )
+				n = MIN((size_t) u8csize(*q), len);
+			else {
+				size_t	b = n;
+				while ( b > 1 && !isblank(q[b - 1]) ) b --;
+				if ( b > 1 ) n = b;
+				}
+			off += n;
+			}
+		else if ( lindex_has(&prv.li, ++ line) )
+			off = prv.li.lines[line];
+		else
+			return false; // end of text
+		if ( prv.rows_count == prv.rows_alloc ) {
+			prv.rows_alloc <<= 1;
+			prv.rows = (ex_row_t *) realloc(prv.rows, sizeof(ex_row_t) * prv.rows_alloc);
+			}
+		prv.rows[prv.rows_count ++] = (ex_row_t) { off, line };
+		}
+	return true;
+	}
+
+// drops the layout if the width of the window changed; the first row
+// displayed stays on the same line
+static void ex_prv_layout() {
+	size_t	line;
+
+	if ( prv.width == getmaxx(w_prv) )
+		return;
+	prv.width = getmaxx(w_prv);
+	if ( prv.rows_count == 0 )
+		return;
+	line = prv.rows[MIN(prv.top, prv.rows_count - 1)].line;
+	prv.rows_count = 0;
+	for ( prv.top = 0; ex_prv_row(prv.top + 1) && prv.rows[prv.top + 1].line <= line; prv.top ++ );
+	}
+
+// scrolls the preview by 'rows'
+static void ex_prv_scroll(int rows) {
+	size_t	want;
+
+	if ( prv.file[0] == '\0' || prv.height <= 0 )
+		return;
+	if ( rows < 0 )
+		want = ( prv.top > (size_t) -rows ) ? prv.top + rows : 0;
+	else
+		want = prv.top + rows;
+	// the last row that fills the window
+	if ( ex_prv_row(want + prv.height - 1) )
+		prv.top = want;
+	else
+		prv.top = ( prv.rows_count > (size_t) prv.height ) ? prv.rows_count - prv.height : 0;
+	}
+
+// draws the row 'r' of the preview at 'y', one call per run of attributes;
+// in markdown, the rest of the row gets the colour of the last run
+static void ex_prv_draw(size_t r, int y, const md_run_t *runs, int count) {
+	size_t	line = prv.rows[r].line, start, end, len, s, e;
+	const char *p = lindex_line(&prv.li, line, &len);
+	int		pair = clr_text;
+
+	// the row is [start, end) of the line
+	start = prv.rows[r].off - prv.li.lines[line];
+	end = ( ex_prv_row(r + 1) && prv.rows[r + 1].line == line ) ? prv.rows[r + 1].off - prv.li.lines[line] : len;
+	wmove(w_prv, y, 0);
+	if ( prv.md ) {
+		for ( int i = 0; i < count; i ++ ) {
+			s = MAX(runs[i].start, start);
+			e = MIN(runs[i].start + runs[i].len, end);
+			if ( s >= e )
+				continue;
+			pair = *md_style[runs[i].kind].pair;
+			wattr_set(w_prv, md_style[runs[i].kind].attr, pair, NULL);
+			waddnstr(w_prv, p + s, e - s);
+			}
+		wattr_set(w_prv, A_NORMAL, 0, NULL);
+		if ( getcury(w_prv) == y )
+			whline(w_prv, ' ' | COLOR_PAIR(pair), getmaxx(w_prv) - getcurx(w_prv));
+		}
+	else
+		waddnstr(w_prv, p + start, end - start);
+	}
+
+// the preview of a note that is not displayed: what it is and its size
+static void ex_prv_summary(const sniff_t *sn) {
+	const char *units[] = { "bytes", "KiB", "MiB", "GiB", "TiB", NULL };
+	double	size = sn->size;
+	int		u = 0;
+
+	while ( size >= 1024 && units[u + 1] ) {
+		size /= 1024;
+		u ++;
+		}
+	nc_wprintf(w_prv, "\n$B%s$b, not displayed.\n",
+		( sn->desc ) ? sn->desc : ( sn->type == SNIFF_HUGE ) ? "Large text" : "Binary data");
+	nc_wprintf(w_prv, "Size: $B%.*f$b %s", ( u ) ? 1 : 0, size, units[u]);
+	if ( sn->type == SNIFF_HUGE )
+		nc_wprintf(w_prv, ", about $B%zu$b lines", sn->lines);
+	waddch(w_prv, '\n');
 	}
 
 // display the contents of the note (preview window)
-void ex_print_note(const note_t *note) {
-	FILE	*fp;
+void ex_print_note(note_t *note) {
 	char	buf[LINE_MAX];
-	bool	inside_code = false;
+	struct stat st;
+	const sniff_t *sn;
+	int		y;
 	
 	werase(w_prv);
 	if ( note ) {
@@ -849,36 +2551,33 @@ void ex_print_note(const note_t *note) {
 		nc_wprintf(w_prv, "Stat: $B%6d$b bytes, mode $B0%o$b, owner $B%d$b:$B%d$b\n",
 			note->st.st_size, note->st.st_mode & 0777, note->st.st_uid, note->st.st_gid);
 		for ( int i = 0; i < getmaxx(w_prv); i ++ ) wprintw(w_prv, "─");
-		if ( (fp = fopen(note->file, "rt")) != NULL ) {
-			while ( fgets(buf, LINE_MAX, fp) ) {
-				if ( strcmp(note->ftype, "md") == 0 ) {
-					int		i, color = clr_text;
-					
-					if ( buf[strlen(buf)-1] == '\n' )
-						buf[strlen(buf)-1] = '\0';
-					
-					switch ( buf[0] ) {
-					case '#': color = ( inside_code ) ? clr_code : clr_text; break;
-					case '`': if ( buf[1] == '`' && buf[2] == '`' ) inside_code = !inside_code; break;
-					case '\t': color = clr_code; break;
-					default: 
-						color = ( inside_code ) ? clr_code : clr_text;
-						}
-					nc_setpair(w_prv, color);
-					wprintw(w_prv, "%s", buf);
-					for ( i = getcurx(w_prv); i < getmaxx(w_prv) ; i ++ ) wprintw(w_prv, " ");
-					nc_unsetpair(w_prv, color);
+		if ( stat(note->file, &st) == -1 )
+			ex_prv_free();
+		else if ( (sn = note_sniff(note, &st))->type != SNIFF_TEXT ) {
+			ex_prv_free();
+			ex_prv_summary(sn);
+			}
+		else if ( ex_prv_load(note, &st) ) {
+			md_run_t runs[MD_RUNS];
+			int		count = 0;
+			size_t	lexed = (size_t) -1, len;
+			const char *p;
+
+			y = getcury(w_prv);
+			prv.height = getmaxy(w_prv) - y;
+			ex_prv_layout();
+			ex_prv_scroll(0); // the text may be shorter now
+			for ( size_t r = prv.top; y < getmaxy(w_prv) && ex_prv_row(r); r ++, y ++ ) {
+				if ( prv.md && prv.rows[r].line != lexed ) { // once per line
+					lexed = prv.rows[r].line;
+					p = lindex_line(&prv.li, lexed, &len);
+					md_lex(p, len, ex_prv_state(lexed), runs, &count);
 					}
-				else
-//					nc_wprintf(w_prv, "%s", buf);
-					wprintw(w_prv, "%s", buf);
-				if ( getcury(w_prv) >= (getmaxy(w_prv)-1) )
-					break;
+				ex_prv_draw(r, y, runs, count);
 				}
-			fclose(fp);
 			}
 		}
-	wrefresh(w_prv);
+	wnoutrefresh(w_prv);
 	}
 
 // qsort callback
@@ -898,6 +2597,7 @@ static int t_str_cmp(const void *va, const void *vb) {
 // help
 static char *ex_help_s = "&? help, &quit, &view, &edit, &rename, &delete, &new, &/ search, &section, &tag, &untag all";
 static char ex_help[LINE_MAX];
+static nc_run_t *ex_help_runs;
 static char *ex_help_long = "\
 ?, F1  ... Help. This window.\n\
 q, ^Q  ... Quit. Terminates the program.\n\
@@ -917,6 +2617,8 @@ m, F2  ... Menu. Open the user-defined menu.\n\
 !, x, F10  Execute something with current/tagged notes[1].\n\
 f      ... Open the notes directory with the file manager.\n\
 F5     ... Rebuild & redraw the list.\n\
+J, K   ... Scroll the preview one line down/up.\n\
+SPACE, b   Scroll the preview one page down/up.\n\
 \n\
 Notes:\n\
 [1] The tagged notes if there are any, otherwise the current note.\n\
@@ -925,10 +2627,22 @@ Notes:\n\
 ";
 //f      ... Set Filter[1].\n
 
+// build the (sorted) table of notes from the list
+bool ex_table() {
+	free(t_notes);
+	t_notes = (note_t **) list_to_table(notes);
+	t_notes_count = list_count(notes);
+	if ( t_notes_count == 0 )
+		return false;
+	qsort(t_notes, t_notes_count, sizeof(note_t*), t_notes_cmp);
+	return true;
+	}
+
 // build the table with notes
 bool ex_build() {
 	if ( notes )
 		list_clear(notes);
+	dirs_clear();
 	if ( strlen(current_section) ) {
 		char path[PATH_MAX];
 		snprintf(path, PATH_MAX, "%s/%s", ndir, current_section);
@@ -936,20 +2650,21 @@ bool ex_build() {
 		}
 	else	
 		dirwalk(ndir);
-	t_notes = (note_t **) list_to_table(notes);
-	t_notes_count = list_count(notes);
-	if ( t_notes_count == 0 )
-		return false;
-	qsort(t_notes, t_notes_count, sizeof(note_t*), t_notes_cmp);
-	return true;
+	return ex_table();
 	}
 
 // rebuild the table with notes
 bool ex_rebuild() {
-	free(t_notes);
 	return ex_build();
 	}
 
+// untag the note, dirwalk_update() callback
+static void ex_untag(note_t *note) {
+	list_node_t *node = list_findptr(tagged, note);
+	if ( node )
+		list_delete(tagged, node);
+	}
+
 // (re)build explorer windows
 void ex_build_windows() {
 	int cols3 = getmaxx(stdscr) / 3;
@@ -965,7 +2680,7 @@ void ex_build_windows() {
 	keypad(w_lst, TRUE);
 	keypad(w_prv, TRUE);
 	keypad(w_inf, TRUE);
-	refresh();
+	wnoutrefresh(stdscr);
 	}
 
 // find a note by name, returns the index in the t_notes
@@ -1033,36 +2748,239 @@ bool ex_select_section(char *result, const char *default_value) {
 	return r;
 	}
 
-//
-void vstrcat(char *buf, ...) {
-	va_list ap;
-	const char *s;
-
-	va_start(ap, buf);
-	while ( (s = va_arg(ap, const char *)) != NULL )
-		strcat(buf, s);
-	va_end(ap);
-	}
-
-//
+// executes 'cmd' with the tagged files;
+// if the files do not fit in one command line, it is executed in batches (as xargs does)
 int ex_tagged_shell(const char *cmd, list_t *tagged) {
-	char files[LINE_MAX];
+	sbuf_t	files;
 	const char *p;
-	size_t root_dir_len = strlen(ndir) + 1;
+	size_t	root_dir_len = strlen(ndir) + 1, limit = note_shell_limit(cmd), len;
+	int		status = 0, rv;
 
-	files[0] = '\0';
+	sbuf_init(&files);
 	for ( list_node_t *cur = tagged->head; cur; cur = cur->next ) {
-		p = ((note_t *) (cur->data))->file;
-		if ( cur != tagged->head ) // add separator
-			strcat(files, " ");
-		vstrcat(files, "'", p + root_dir_len, "'", NULL);
+		p = ((note_t *) (cur->data))->file + root_dir_len;
+		len = strlen(p) + 3 + sizeof(char *);
+		if ( files.len && files.len + len > limit ) { // flush batch
+			if ( (rv = note_shell(cmd, files.ptr)) != 0 )
+				status = rv;
+			sbuf_clear(&files);
+			}
+		if ( files.len ) // add separator
+			sbuf_addc(&files, ' ');
+		sbuf_addc(&files, '\'');
+		sbuf_add(&files, p);
+		sbuf_addc(&files, '\'');
+		}
+	if ( files.len && (rv = note_shell(cmd, files.ptr)) != 0 )
+		status = rv;
+	sbuf_free(&files);
+	return status;
+	}
+
+// === bulk operations ===
+// Delete or move of the tagged notes runs on a pool of worker threads; the UI thread
+// displays the progress, applies the results to the catalog and can cancel it (^C).
+typedef struct {
+	note_t	*note;
+	char	target[PATH_MAX];	// move: the new file
+	int		err;				// errno, 0 = success
+	char	msg[FILE_ERRSZ];	// the first error of the file operations, if any
+	int		state;				// 0 = pending, 1 = done, 2 = applied to the catalog
+	} bulk_item_t;
+
+typedef struct {
+	int		op;					// 'd' = delete, 'c' = change section
+	bulk_item_t *items;
+	int		count;
+	int		next;				// the next item to process
+	int		done, fail;			// counters
+	int		running;			// number of running workers
+	bool	cancel;
+	} bulk_t;
+
+// worker thread
+static void *bulk_worker(void *arg) {
+	bulk_t	*job = (bulk_t *) arg;
+	bulk_item_t *it;
+	int		i;
+
+	while ( !__atomic_load_n(&job->cancel, __ATOMIC_RELAXED) ) {
+		if ( (i = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED)) >= job->count )
+			break;
+		it = &job->items[i];
+		file_errbuf = it->msg;
+		errno = 0;
+		if ( !note_backup(it->note) && job->op == 'd' ) { // keep the note without its backup
+			it->err = ( errno ) ? errno : EIO;
+			if ( it->msg[0] == '\0' )
+				snprintf(it->msg, FILE_ERRSZ, "%s: backup failed: %s", it->note->file, strerror(it->err));
+			}
+		else if ( job->op == 'd' )
+			it->err = ( remove(it->note->file) == 0 ) ? 0 : errno;
+		else
+			it->err = move_file(it->note->file, it->target, (opt_flags & OPT_NOCLOB));
+		if ( it->err )
+			__atomic_fetch_add(&job->fail, 1, __ATOMIC_RELAXED);
+		__atomic_store_n(&it->state, 1, __ATOMIC_RELEASE);
+		__atomic_fetch_add(&job->done, 1, __ATOMIC_RELEASE);
+		}
+	file_errbuf = NULL;
+	__atomic_fetch_sub(&job->running, 1, __ATOMIC_RELEASE);
+	return NULL;
+	}
+
+// qsort/bsearch callback
+static int ptr_cmp(const void *a, const void *b) {
+	const void *pa = *(const void **) a, *pb = *(const void **) b;
+	return (pa < pb) ? -1 : (pa > pb);
+	}
+
+// list_delete_if() callback, true if the note is in the sorted table 'bulk_gone'
+static note_t **bulk_gone;
+static int bulk_gone_count;
+static bool bulk_isgone(void *data, void *arg) {
+	return bsearch(&data, bulk_gone, bulk_gone_count, sizeof(note_t *), ptr_cmp) != NULL;
+	}
+
+// apply the finished items to the catalog; returns true if the table changed
+static bool bulk_apply(bulk_t *job, const char *new_section) {
+	bool	changed = false;
+	size_t	cslen = strlen(current_section);
+	int		i, j;
+
+	for ( i = 0; i < job->count; i ++ ) {
+		bulk_item_t *it = &job->items[i];
+		if ( __atomic_load_n(&it->state, __ATOMIC_ACQUIRE) != 1 )
+			continue;
+		it->state = 2;
+		if ( it->err )
+			continue;
+		if ( job->op == 'c' ) {
+			strcpy(it->note->file, it->target);
+			strcpy(it->note->section, new_section);
+			if ( list_findstr(sections, new_section) == NULL )
+				list_addstr(sections, new_section);
+			if ( cslen == 0 || (strncmp(new_section, current_section, cslen) == 0
+					&& (new_section[cslen] == '\0' || new_section[cslen] == '/')) )
+				continue; // still visible
+			}
+		bulk_gone[bulk_gone_count ++] = it->note;
+		changed = true;
 		}
-	return note_shell(cmd, files);
+	if ( changed ) { // remove them from the table
+		qsort(bulk_gone, bulk_gone_count, sizeof(note_t *), ptr_cmp);
+		for ( i = j = 0; i < t_notes_count; i ++ )
+			if ( !bsearch(&t_notes[i], bulk_gone, bulk_gone_count, sizeof(note_t *), ptr_cmp) )
+				t_notes[j ++] = t_notes[i];
+		t_notes[j] = NULL;
+		t_notes_count = j;
+		}
+	return changed;
+	}
+
+// delete ('d') or move to 'new_section' ('c') the tagged notes; the result is written in 'status'
+void ex_bulk(int op, const char *new_section, int offset, char *status) {
+	bulk_t	job;
+	int		i, nthreads, ch;
+	long	ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	pthread_t *threads;
+	list_node_t *cur;
+	const char *verb = ( op == 'd' ) ? "deleted" : "moved";
+	
+	memset(&job, 0, sizeof(job));
+	job.op = op;
+	job.count = list_count(tagged);
+	job.items = (bulk_item_t *) calloc(job.count, sizeof(bulk_item_t));
+	for ( i = 0, cur = tagged->head; cur; cur = cur->next, i ++ ) {
+		note_t *note = (note_t *) cur->data;
+		job.items[i].note = note;
+		if ( op == 'c' ) // keeps the file type
+			snprintf(job.items[i].target, PATH_MAX, "%s/%s/%s%s%s", ndir, new_section, note->name,
+				(strlen(note->ftype)) ? "." : "", note->ftype);
+		}
+	bulk_gone = (note_t **) malloc(sizeof(note_t *) * (job.count + 1));
+	bulk_gone_count = 0;
+
+	// start the workers
+	nthreads = MIN(MAX(ncpu, 1) * 2, 16);
+	nthreads = MIN(nthreads, job.count);
+	threads = (pthread_t *) malloc(sizeof(pthread_t) * nthreads);
+	job.running = nthreads;
+	for ( i = 0; i < nthreads; i ++ )
+		if ( pthread_create(&threads[i], NULL, bulk_worker, &job) != 0 )
+			break;
+	__atomic_fetch_sub(&job.running, nthreads - i, __ATOMIC_RELEASE);
+	nthreads = i;
+	if ( nthreads == 0 ) { // no threads, do it here
+		job.running = 1;
+		bulk_worker(&job);
+		}
+
+	// progress
+	wtimeout(w_inf, 100);
+	while ( true ) {
+		if ( bulk_apply(&job, new_section) ) {
+			offset = MAX(0, MIN(offset, t_notes_count - getmaxy(w_lst)));
+			ex_print_list(offset, -1);
+			}
+		if ( __atomic_load_n(&job.running, __ATOMIC_ACQUIRE) == 0 )
+			break;
+		ex_status_line("%s %d/%d, %d failed%s", (op == 'd') ? "deleting" : "moving",
+			__atomic_load_n(&job.done, __ATOMIC_RELAXED), job.count, __atomic_load_n(&job.fail, __ATOMIC_RELAXED),
+			(job.cancel) ? ", canceling..." : " (^C to cancel)");
+		ex_frame();
+		ch = wgetch(w_inf);
+		// ^C is bound to both cancel and exit, nc_getprg() returns the latter
+		if ( ch == 3 || (ch != ERR && KPRG_KEY(nc_getprg("nav", ch)) == KEY_CANCEL) )
+			__atomic_store_n(&job.cancel, true, __ATOMIC_RELAXED);
+		}
+	wtimeout(w_inf, -1);
+	for ( i = 0; i < nthreads; i ++ )
+		pthread_join(threads[i], NULL);
+	bulk_apply(&job, new_section);
+
+	// remove the deleted notes from the list
+	list_clear(tagged);
+	qsort(bulk_gone, bulk_gone_count, sizeof(note_t *), ptr_cmp);
+	list_delete_if(notes, bulk_isgone, NULL);
+	ex_table();
+
+	// report
+	int succ = job.done - job.fail;
+	if ( succ == 1 ) sprintf(status, "one note %s%c", verb, ((job.fail || job.cancel)?';':'.'));
+	else sprintf(status, "%d notes %s%c", succ, verb, ((job.fail || job.cancel)?';':'.'));
+	if ( job.fail ) sprintf(status+strlen(status), " %d failed%c", job.fail, (job.cancel)?';':'.');
+	if ( job.cancel ) sprintf(status+strlen(status), " %d canceled.", job.count - job.done);
+	if ( job.fail ) { // display the errors, the first one on the status line too
+		sbuf_t	errs;
+		char	line[PATH_MAX + FILE_ERRSZ];
+		sbuf_init(&errs);
+		for ( i = 0; i < job.count; i ++ ) {
+			bulk_item_t *it = &job.items[i];
+			if ( it->state && it->err ) {
+				if ( it->msg[0] )
+					snprintf(line, sizeof(line), "%s\n", it->msg);
+				else
+					snprintf(line, sizeof(line), "%s: %s\n", it->note->file + strlen(ndir) + 1,
+						(it->err == EEXIST) ? "already exists" : strerror(it->err));
+				if ( errs.len == 0 )
+					snprintf(status + strlen(status), LINE_MAX - strlen(status), " %.*s",
+						(int) strlen(line) - 1, line);
+				sbuf_add(&errs, line);
+				}
+			}
+		nc_view("Errors", errs.ptr);
+		sbuf_free(&errs);
+		}
+	free(threads);
+	free(bulk_gone);
+	bulk_gone = NULL;
+	free(job.items);
 	}
 
 //
 #define ex_presh()		{ clear(); refresh(); def_prog_mode(); endwin(); }
-#define ex_refresh()	{ keep_status = 1; clear(); ungetch(12); }
+#define ex_refresh()	ex_repaint()
 #define fix_offset()	{ \
 	if ( pos < 0 ) pos = 0; \
 	if ( pos >= t_notes_count ) pos = t_notes_count - 1; \
@@ -1070,23 +2988,28 @@ int ex_tagged_shell(const char *cmd, list_t *tagged) {
 	if ( offset > pos ) offset = pos; \
 	if ( offset < 0 ) offset = 0; }
 #define INF_PREFIX	10
+#define SED_WIDTH	MIN(getmaxx(w_inf) - INF_PREFIX, (NAME_MAX - 3) / 4)	// of the search editor
 
 // TUI
 void explorer() {
 	bool	exitf = false;
 	int		ch, pf, offset = 0, pos = 0;
-	int		lines, keep_status = 0;
+	int		lines;
 	char	buf[LINE_MAX];
 	char	prompt[LINE_MAX];
 	char	status[LINE_MAX];
 	char	search[NAME_MAX];
-	wchar_t	wsearch[NAME_MAX];
-	int		spos, slen, i, maxlen;
-	bool	insert = true;
+	nc_ledit_t sed;				// search editor
+	int		scount = -1;		// the notes count displayed in search mode
 	ex_mode_t mode = ex_nav;
+	bool	sync_failed = false;	// the background onstart did not start
 	
-	if ( strlen(onstart_cmd) )
-		system(onstart_cmd);
+	if ( strlen(onstart_cmd) ) {
+		if ( istrue(onstart_async) )
+			sync_failed = !ex_sync_start();
+		else
+			sh_exec(onstart_cmd);
+		}
 
 	ex_build();
 	tagged = list_create();
@@ -1095,22 +3018,26 @@ void explorer() {
 	if ( COLORS >= 256 ) {
 		clr_code = nc_createpair(COLOR_GREEN, COLOR_BLACK);
 		clr_text = nc_createpair(COLOR_WHITE, COLOR_BLACK);
+		clr_head = nc_createpair(COLOR_YELLOW, COLOR_BLACK);
+		clr_link = nc_createpair(COLOR_CYAN, COLOR_BLACK);
 		}
 	else {
 		clr_code = nc_createpair(COLOR_GREEN, COLOR_BLACK);
 		clr_text = nc_createpair(COLOR_WHITE, COLOR_BLACK);
+		clr_head = nc_createpair(COLOR_YELLOW, COLOR_BLACK);
+		clr_link = nc_createpair(COLOR_CYAN, COLOR_BLACK);
 		}
 	
 	raw();
 	set_default_keymap();
 	ex_build_windows();
 	ex_colorize(ex_help, ex_help_s);
+	ex_help_runs = nc_compile(ex_help);
 	
 	status[0]  = '\0';
 	search[0]  = '\0';
-	wsearch[0] = L'\0';
-	spos = slen = 0;
-	maxlen = getmaxx(w_inf) - INF_PREFIX;
+	if ( sync_failed )
+		snprintf(status, LINE_MAX, "onstart: %s", sync_msg);
 	do {
 		lines = getmaxy(stdscr) - 2;
 		fix_offset();
@@ -1118,97 +3045,81 @@ void explorer() {
 		if ( t_notes_count )
 			ex_print_note(t_notes[pos]);
 		
-		if ( mode == ex_search ) {
-			ex_status_line("%s", search);
-			wmove(w_inf, 0, spos+(INF_PREFIX-1));
+		if ( mode == ex_search ) { // the status line only if the count changed
+			if ( scount != list_count(notes) ) {
+				scount = list_count(notes);
+				ex_status_line("%s", "");
+				nc_ledit_invalidate(&sed);
+				}
+			nc_ledit_draw(&sed);
+			wnoutrefresh(w_inf);
 			}
 		else if ( status[0] == '\0' )
-			ex_status_line("%s", ex_help);
+			ex_status_runs(ex_help_runs);
 		else {
 			ex_status_line("%s", status);
-			if ( keep_status )
-				keep_status --;
-			else
-				status[0] = '\0';
+			status[0] = '\0';
 			}
+		ex_frame();
 		
 		// read key
+		wtimeout(w_inf, (sync_pid > 0) ? 250 : -1);
 		ch = wgetch(w_inf);
+		if ( ch == ERR ) {
+			if ( ex_sync_poll(false) ) { // onstart finished, rescan the modified directories
+				char	name[NAME_MAX];
+				
+				strcpy(name, (t_notes_count) ? t_notes[pos]->name : "");
+				if ( dirwalk_update(ex_untag) ) {
+					ex_table();
+					if ( (pos = ex_find(name)) == -1 ) pos = 0;
+					}
+				if ( WIFEXITED(sync_status) && WEXITSTATUS(sync_status) == 0 )
+					sprintf(status, "onstart: finished.");
+				else
+					sprintf(status, "onstart: failed (%d) %s", WEXITSTATUS(sync_status), sync_msg);
+				}
+			continue;
+			}
 
 		// input string mode
 		if ( mode == ex_search ) {
 			pf = nc_getprg("input", ch);
-			wchar_t wch = (wchar_t) ch;
-			if ( u8ischar(ch) ) {
-				char mbs[7];
-				int keylen = u8csize(ch);
-				mbs[0] = ch;
-				for ( i = 1; i < keylen; i ++ )
-					mbs[i] = wgetch(w_inf);
-				mbs[keylen] = '\0';
-				wch = u8towc(mbs);
-				}
 			switch ( KPRG_KEY(pf) ) {
 			case KEY_CANCEL:
 				search[0] = '\0';
-				wsearch[0] = L'\0';
-				spos = 0;
+				nc_ledit_free(&sed);
 				mode = ex_nav;
 				curs_set(0);
 				strcpy(current_filter, "");
 				ex_rebuild();
 				continue;
 			case KEY_ENTER:	// enter -> view current note
+				nc_ledit_free(&sed);
 				mode = ex_nav;
 				sprintf(current_filter, "*%s*", search);
 				curs_set(0);
 				ex_rebuild();
 				ex_refresh();
 				continue;
-			case KEY_LEFT:	if ( spos ) spos --; break;
-			case KEY_RIGHT:	if ( search[spos] ) spos ++; break;
-			case KEY_HOME:	spos = 0; break;
-			case KEY_END:	spos = slen; break;
-			case KEY_BACKSPACE:
-				if ( spos ) {
-					spos --; slen --;
-					for ( i = spos; wsearch[i]; i ++ )
-						wsearch[i] = wsearch[i+1];
-					wsearch[slen] = '\0';
-					}
-				break;
-			case KEY_DC:
-				if ( wsearch[spos] ) {
-					for ( i = spos; wsearch[i]; i ++ )
-						wsearch[i] = wsearch[i+1];
-					slen --;
+			case KEY_RESIZE: // new windows, the editor takes the new width
+				ex_build_windows();
+				mvvline(0, getmaxx(stdscr) / 3, ' ', getmaxy(stdscr) - 1);
+				nc_ledit_resize(&sed, w_inf, SED_WIDTH);
+				scount = -1;
+				if ( strcmp(nc_ledit_text(&sed, buf), search) != 0 ) { // cut to the new width
+					strcpy(search, buf);
+					sprintf(current_filter, "*%s*", search);
+					ex_rebuild();
 					}
-				break;
-			case KEY_IC:	
-				insert = !insert;
-				curs_set((insert)?1:2);
-				break;
+				continue;
 			default:
-				if ( slen < maxlen ) {
-					if ( insert ) {
-						for ( i = slen; i >= spos; i -- )
-							wsearch[i+1] = wsearch[i];
-						wsearch[spos] = wch;
-						wsearch[++ slen] = '\0';
-						}
-					else {
-						wsearch[spos] = wch;
-						if ( spos == slen )
-							wsearch[++ slen] = '\0';
-						}
-					spos ++;
+				if ( nc_ledit_key(&sed, KPRG_KEY(pf)) > 0 ) { // rebuild everything
+					nc_ledit_text(&sed, search);
+					sprintf(current_filter, "*%s*", search);
+					ex_rebuild();
 					}
 				}
-			
-			// rebuild everything
-			u8cpytostr(search, wsearch);
-			sprintf(current_filter, "*%s*", search);
-			ex_rebuild();
 			}
 
 		// navigation mode
@@ -1220,7 +3131,6 @@ void explorer() {
 			case KEY_REFRESH:
 				ex_build_windows();
 				mvvline(0, getmaxx(stdscr) / 3, ' ', getmaxy(stdscr) - 1);
-				maxlen = getmaxx(w_inf) - INF_PREFIX;
 				break;
 			case KEY_EXIT:
 				exitf = true;
@@ -1244,6 +3154,12 @@ void explorer() {
 			case KEY_HOME:
 				offset = pos = 0;
 				break;
+			case 'K': case 'J': // scroll the preview
+				ex_prv_scroll((KPRG_KEY(pf) == 'J') ? 1 : -1);
+				break;
+			case 'b': case ' ':
+				ex_prv_scroll((KPRG_KEY(pf) == ' ') ? prv.height - 1 : 1 - prv.height);
+				break;
 			case KEY_END:
 				if ( t_notes_count )
 					pos = t_notes_count - 1;
@@ -1262,8 +3178,10 @@ void explorer() {
 				break;
 			case KEY_ENTER:	// enter -> view current note
 				if ( t_notes_count ) {
-					ex_presh();
-					rule_exec('v', t_notes[pos]->file);
+					if ( !rule_view_internal(t_notes[pos]->file) ) {
+						ex_presh();
+						rule_exec('v', t_notes[pos]->file);
+						}
 					ex_refresh();
 					}
 				break;
@@ -1285,11 +3203,14 @@ void explorer() {
 				break;
 			case 'v': // view in pager
 				if ( t_notes_count ) {
-					ex_presh();
-					if ( list_count(tagged) )
+					if ( list_count(tagged) ) {
+						ex_presh();
 						ex_tagged_shell("$PAGER %f", tagged);
-					else
+						}
+					else if ( !rule_view_internal(t_notes[pos]->file) ) {
+						ex_presh();
 						rule_exec('v', t_notes[pos]->file);
+						}
 					ex_refresh();
 					}
 				break;
@@ -1304,18 +3225,42 @@ void explorer() {
 	//			break;
 			case KEY_FIND: // search
 				search[0] = '\0';
-				wsearch[0] = L'\0';
-				spos = slen = 0;
+				nc_ledit_init(&sed, w_inf, 0, INF_PREFIX - 1, SED_WIDTH, search);
+				sed.attr = A_REVERSE;
+				scount = -1;
 				mode = ex_search;
 				curs_set(1);
 				break;
 			case 'e': // edit
 				if ( t_notes_count ) {
+					int		i, tcnt = list_count(tagged);
+					bool	gone = false;
+					fprint_t *fps;
+					list_node_t *cur;
+					
+					if ( !tcnt )
+						list_addptr(tagged, t_notes[pos]);
+					fps = (fprint_t *) malloc(sizeof(fprint_t) * list_count(tagged));
+					for ( i = 0, cur = tagged->head; cur; cur = cur->next, i ++ )
+						note_edit_begin((note_t *) cur->data, &fps[i]);
 					ex_presh();
-					if ( list_count(tagged) )
+					if ( tcnt )
 						ex_tagged_shell("$EDITOR %f", tagged);
 					else
 						rule_exec('e', t_notes[pos]->file);
+					
+					// only the modified notes are updated
+					for ( i = 0, cur = tagged->head; cur; cur = cur->next, i ++ ) {
+						if ( note_edit_end((note_t *) cur->data, &fps[i]) )
+							gone |= (access(((note_t *) cur->data)->file, F_OK) != 0);
+						}
+					free(fps);
+					if ( !tcnt )
+						list_clear(tagged);
+					if ( gone ) {
+						list_clear(tagged);
+						ex_rebuild();
+						}
 					ex_refresh();
 					}
 				break;
@@ -1363,173 +3308,1117 @@ void explorer() {
 								list_addptr(tagged, t_notes[pos]);
 							
 							// move files
-							int succ = 0, fail = 0;
-							for ( list_node_t *cur = tagged->head; cur; cur = cur->next ) {
-								note_t *cn = (note_t *) cur->data;
-								note_backup(cn);
-								note_t *nn = make_note(cn->name, new_section, 0);
-								if ( rename(cn->file, nn->file) != 0 ) {
-									sprintf(status, "move failed");
-									fail ++;
-									}
-								else
-									succ ++;
-								free(nn);
-								}
+							ex_bulk('c', new_section, offset, status);
+
+							// cleanup
+							free(new_section);
+							}
+						}
+					
+					ex_refresh();
+					}
+				break;
+	/*
+			case KEY_REFRESH:
+				ex_rebuild();
+				sprintf(status, "rebuilded.");
+				ex_refresh();
+				break;
+	*/
+			case 'f': // show in filemanager
+				{
+				char *fmans[] = { "xdg-open", "mc", "thunar", "dolphin", NULL };
+				int idx = nc_listbox("File Manager", (const char **) fmans, 0);
+				if ( idx > -1 ) {
+					ex_presh();
+					sprintf(buf, "%s '%s'", fmans[idx], ndir);
+					sh_exec(buf);
+					}
+				ex_refresh();
+				break;
+				}
+			case KEY_DC: // delete
+				if ( t_notes_count ) {
+					strcpy(buf, "");
+					if ( list_count(tagged) )
+						sprintf(prompt, "Delete all tagged notes ?");
+					else
+						sprintf(prompt, "Do you want to delete '%s' ?", t_notes[pos]->name);
+					
+					if ( ex_input(buf, "%s", prompt) && istrue(buf) ) {
+						if ( !list_count(tagged) )
+							list_addptr(tagged, t_notes[pos]);
+						ex_bulk('d', NULL, offset, status);
+						if ( t_notes_count ) {
+							if ( pos >= t_notes_count )
+								pos = t_notes_count - 1;
+							}
+						else
+							offset = pos = 0;
+						}
+					ex_refresh();
+					}
+				break;
+			case 'r':	// rename
+				if ( t_notes_count ) {
+					strcpy(buf, t_notes[pos]->name);
+					if ( ex_input(buf, "Enter the new name ([section/]new-name[.extension])", t_notes[pos]->name)
+							&& strlen(buf)
+							&& strcmp(buf, t_notes[pos]->name) != 0 ) {
+						note_t *nn = make_note(buf, t_notes[pos]->section, 0);
+						bool replace = (opt_flags & OPT_NOCLOB);
+						int err;
+						
+						if ( replace && access(nn->file, F_OK) == 0 )
+							note_backup(nn); // it will be overwritten
+						if ( (err = move_file(t_notes[pos]->file, nn->file, replace)) == EEXIST )
+							sprintf(status, "'%s' already exists.", nn->name);
+						else if ( err )
+							sprintf(status, "rename failed: errno (%d) %s", err, strerror(err));
+						free(nn);
+						ex_rebuild();
+						if ( (pos = ex_find(buf)) == -1 ) pos = 0;
+						}
+					ex_refresh();
+					}
+				break;
+			case 'm':
+				if ( t_notes_count && umenu->head ) {
+					int idx;
+					umenu_item_t **opts;
+					
+					opts = (umenu_item_t **) list_to_table(umenu);
+					if ( (idx = nc_listbox("User Menu", (const char **) opts, 0)) > -1 ) {
+						int tcnt = list_count(tagged);
+						if ( !tcnt )
+							list_addptr(tagged, t_notes[pos]);
+						
+						ex_presh();
+						ex_tagged_shell(opts[idx]->cmd, tagged);
+						printf("\nPress any key to return...\n");
+						getch();
+						if ( !tcnt )
+							list_clear(tagged);
+						}
+					free(opts);
+					ex_refresh();
+					}
+				break;
+			case '!':
+				if ( t_notes_count ) {
+					char	cmd[LINE_MAX];
+					strcpy(cmd, "");
+					if ( ex_input(cmd, "Enter command (use '%%f' for files)") && strlen(cmd) ) {
+						int tcnt = list_count(tagged);
+						if ( !tcnt )
+							list_addptr(tagged, t_notes[pos]);
+						ex_presh();
+						ex_tagged_shell(cmd, tagged);
+						printf("\nPress any key to return...\n");
+						getch();
+						if ( !tcnt )
+							list_clear(tagged);
+						}
+					ex_refresh();
+					}
+				break;
+			case 'a':
+			case 'n':
+				strcpy(buf, "");
+				if ( ex_input(buf, "Enter new name ([section/]new-name[.extension])") && strlen(buf) ) {
+					note_t *note = make_note(buf, current_section, (ch == KEY_CREATE) ? 0 : 1);
+					if ( note ) {
+						sprintf(status, "'%s' created", note->name);
+						ex_rebuild();
+						if ( (pos = ex_find(note->name)) == -1 ) pos = 0;
+						if ( ch == 'n' ) { // 'new' key invokes the editor, 'add' key do not
+							ex_presh();
+							rule_exec('e', note->file);
+							}
+						free(note);
+						}
+					else
+						sprintf(status, "failed: errno (%d) %s", errno, strerror(errno));
+					}
+				ex_refresh();
+				break;
+				}
+			}
+		} while ( !exitf );
+	if ( mode == ex_search )
+		nc_ledit_free(&sed);
+	nc_close();
+	ex_prv_free();
+	sniff_free();
+	free(ex_help_runs);
+	tagged = list_destroy(tagged);
+	free(t_notes);
+	if ( sync_pid > 0 ) {
+		printf("waiting for the onstart command to finish...\n");
+		ex_sync_poll(true);
+		}
+	if ( strlen(onexit_cmd) ) {
+		if ( istrue(onexit_detach) )
+			sh_start(onexit_cmd, SH_DETACH, NULL);
+		else
+			sh_exec(onexit_cmd);
+		}
+	}
+
+// === backup history =====================================================
+
+// print the backups of the notes that match the pattern (mode --history)
+int note_history(const char *pattern, const char *section) {
+	list_t	*list = bstore_history(pattern, section);
+	char	buf[128], obj[PATH_MAX];
+	struct stat st;
+	int		n = 0;
+	
+	for ( list_node_t *cur = list->head; cur; cur = cur->next ) {
+		bhist_t *rec = (bhist_t *) cur->data;
+		if ( stat(bstore_object(rec->hash, obj), &st) != 0 )
+			st.st_size = -1;
+		printf("%4d  %s  %.12s %9ld  %s\n", ++ n, sdate(&rec->time, buf), rec->hash, (long) st.st_size, rec->file);
+		}
+	if ( n == 0 )
+		fprintf(stderr, "* no backups found *\n");
+	list_destroy(list);
+	return (n) ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
+// restore the backup number 'which' (as printed by --history), or the last one (mode --restore)
+int note_restore(const char *pattern, const char *section, const char *which) {
+	list_t	*list = bstore_history(pattern, section);
+	bhist_t	*rec = NULL;
+	char	obj[PATH_MAX], target[PATH_MAX], *p;
+	int		n = 0, idx = (which) ? atoi(which) : 0, exit_code = EXIT_FAILURE;
+	
+	for ( list_node_t *cur = list->head; cur; cur = cur->next ) {
+		bhist_t *r = (bhist_t *) cur->data;
+		n ++;
+		if ( idx == 0 ) { // the last one, only if all records are of the same file
+			if ( rec && strcmp(rec->file, r->file) != 0 ) {
+				fprintf(stderr, "more than one notes match; use --history and the record number.\n");
+				list_destroy(list);
+				return exit_code;
+				}
+			rec = r;
+			}
+		else if ( idx == n )
+			rec = r;
+		}
+	if ( rec ) {
+		bstore_object(rec->hash, obj);
+		snprintf(target, PATH_MAX, "%s/%s", ndir, rec->file);
+		if ( access(target, F_OK) == 0 ) { // backup the current
+			note_t note;
+			strcpy(note.file, target);
+			note_backup(&note);
+			}
+		else if ( (p = strrchr(rec->file, '/')) != NULL ) {
+			char sec[PATH_MAX];
+			strncpy(sec, rec->file, p - rec->file);
+			sec[p - rec->file] = '\0';
+			make_section(sec);
+			}
+		if ( copy_file(obj, target) ) {
+			utimensat(AT_FDCWD, target, NULL, 0); // it is a new version
+			printf("* '%s' restored from %.12s *\n", rec->file, rec->hash);
+			exit_code = EXIT_SUCCESS;
+			}
+		}
+	else
+		fprintf(stderr, "* no backups found *\n");
+	list_destroy(list);
+	return exit_code;
+	}
+
+// === completion ===========================================================
+//
+//	--complete [-s section] word: prints the names and the sections that start
+//	with 'word' (case-insensitive), one per line. The candidates are searched in
+//	two sorted arrays (the prefix index), the note names and the section/name paths.
+//	A path is displayed only up to the next '/', so the sections are completed
+//	level by level. The case variants of a name or a section are one candidate.
+//
+
+static char	**cx_names, **cx_paths;
+static size_t	cx_count;
+static bool	cx_stale = true;		// the catalog changed, rebuild the index
+
+// case-insensitive order, the case variants of a string are adjacent and sorted
+static int cx_cmp(const void *a, const void *b) {
+	const char *sa = *((const char **) a), *sb = *((const char **) b);
+	int		d = strcasecmp(sa, sb);
+	return ( d ) ? d : strcmp(sa, sb);
+	}
+
+// the first element that is not less than 'prefix'
+static size_t cx_lower(char **idx, const char *prefix) {
+	size_t	lo = 0, hi = cx_count, mid, len = strlen(prefix);
+	
+	while ( lo < hi ) {
+		mid = (lo + hi) / 2;
+		if ( strncasecmp(idx[mid], prefix, len) < 0 )
+			lo = mid + 1;
+		else
+			hi = mid;
+		}
+	return lo;
+	}
+
+// build the index from the notes list
+void cx_build() {
+	list_node_t *cur;
+	note_t	*note;
+	size_t	i = 0;
+	
+	for ( ; cx_count; cx_count -- ) {
+		free(cx_names[cx_count - 1]);
+		free(cx_paths[cx_count - 1]);
+		}
+	cx_count = list_count(notes);
+	cx_names = (char **) realloc(cx_names, sizeof(char *) * (cx_count + 1));
+	cx_paths = (char **) realloc(cx_paths, sizeof(char *) * (cx_count + 1));
+	for ( cur = notes->head; cur; cur = cur->next, i ++ ) {
+		note = (note_t *) cur->data;
+		cx_names[i] = strdup(note->name);
+		if ( strlen(note->section) )
+			cx_paths[i] = concat(note->section, "/", note->name, NULL);
+		else
+			cx_paths[i] = strdup(note->name);
+		}
+	qsort(cx_names, cx_count, sizeof(char *), cx_cmp);
+	qsort(cx_paths, cx_count, sizeof(char *), cx_cmp);
+	cx_stale = false;
+	}
+
+// add the candidates for 'word' to 'out', new-line separated;
+// with 'section' only the notes of this section are candidates
+void cx_list(const char *word, const char *section, sbuf_t *out) {
+	char	prefix[PATH_MAX], *p, *last = NULL;
+	size_t	i, len, plen, lastlen = 0;
+	
+	if ( cx_stale )
+		cx_build();
+	
+	// notes of the section
+	if ( section ) {
+		plen = snprintf(prefix, sizeof(prefix), "%s/%s", section, word);
+		len = strlen(section) + 1;
+		for ( i = cx_lower(cx_paths, prefix); i < cx_count && strncasecmp(cx_paths[i], prefix, plen) == 0; i ++ ) {
+			if ( strncasecmp(cx_paths[i], section, len - 1) == 0 && strchr(cx_paths[i] + len, '/') == NULL ) {
+				if ( last && strcasecmp(last, cx_paths[i] + len) == 0 )
+					continue;
+				sbuf_add(out, last = cx_paths[i] + len);
+				sbuf_addc(out, '\n');
+				}
+			}
+		return;
+		}
+	
+	// names of notes, unique
+	plen = strlen(word);
+	if ( strchr(word, '/') == NULL ) {
+		for ( i = cx_lower(cx_names, word); i < cx_count && strncasecmp(cx_names[i], word, plen) == 0; i ++ ) {
+			if ( last && strcasecmp(last, cx_names[i]) == 0 )
+				continue;
+			sbuf_add(out, last = cx_names[i]);
+			sbuf_addc(out, '\n');
+			}
+		}
+	
+	// sections, and the notes of the section if the word has one
+	last = NULL;
+	for ( i = cx_lower(cx_paths, word); i < cx_count && strncasecmp(cx_paths[i], word, plen) == 0; i ++ ) {
+		if ( (p = strchr(cx_paths[i] + plen, '/')) != NULL )
+			len = p - cx_paths[i] + 1;
+		else if ( strchr(word, '/') )
+			len = strlen(cx_paths[i]);
+		else
+			continue; // a note in the root, in the names already
+		if ( last && lastlen == len && strncasecmp(last, cx_paths[i], len) == 0 )
+			continue;
+		sbuf_addn(out, last = cx_paths[i], lastlen = len);
+		sbuf_addc(out, '\n');
+		}
+	}
+
+// === service ==============================================================
+//
+//	'notes --serve' keeps the configuration and the catalog loaded, the catalog
+//	is kept current with inotify. It accepts appends (-a+) and queries through a
+//	unix socket.
+//
+//	The records of the appends are collected per note and written with one write()
+//	per note (group write); the notes are synced periodically. The clients are
+//	acknowledged after their record is written. A client that is still sending
+//	after SRV_STREAM_MS (tail -f) has its complete lines written as records.
+//
+//	append:  "A\t<notebook>\t<section>\t<name>\t<create>\n"
+//	reply:   "GO <file>\n", "NB\n" (other notebook) or "ERR <errno> <file>\n"
+//	then the client sends the data until EOF and the service replies "OK\n" or "ERR ...".
+//
+//	query:   "Q\t<notebook>\t<section>\t<use-section>\t<pattern>\n"
+//	reply:   "GO\n" or "NB\n", then NUL terminated records: "S<section>" the longest
+//	section name (for the list format) and "F<file>" for each matching note.
+//
+
+#define SRV_MAXHDR		(PATH_MAX * 2)
+#define SRV_DIRECT		(1024 * 1024)	// larger records are written while receiving
+#define SRV_SYNC_MS		1000			// fsync period
+#define SRV_OPEN_MAX	64				// cached note descriptors
+#define SRV_RETRY_MS	20				// retry period of the writes to a locked note
+#define SRV_STREAM_MS	200				// delay of the lines of a stream
+
+typedef struct {
+	char	file[PATH_MAX];
+	int		fd;
+	sbuf_t	pend;		// complete records waiting for the group write
+	list_t	*acks;		// clients to acknowledge after the write
+	void	*owner;		// client that writes a large record directly, it stays
+						// the owner after its EOF until the rest is written
+	bool	dirty;		// written but not synced
+	} srv_note_t;
+
+typedef struct {
+	int		fd;			// connection
+	sbuf_t	buf;		// header, then data
+	sbuf_t	out;		// the reply to a query, sent as the socket accepts it
+	size_t	sent;		// bytes of 'out' sent
+	srv_note_t *note;	// NULL until the header is received
+	bool	done;		// EOF received, waiting for the write
+	struct timespec since;	// when 'buf' got its oldest data
+	} srv_client_t;
+
+static volatile sig_atomic_t srv_quit;
+static int	srv_ifd = -1;		// inotify
+static bool	srv_wait;			// wait for the locks of the notes (on exit)
+static void srv_signal(int sig) { srv_quit = 1; }
+
+// milliseconds from 'from' to 'to'
+static long srv_elapsed(const struct timespec *from, const struct timespec *to) {
+	return (to->tv_sec - from->tv_sec) * 1000 + (to->tv_nsec - from->tv_nsec) / 1000000;
+	}
+
+// create the socket and the address of the service
+static int srv_socket(struct sockaddr_un *addr) {
+	const char *rd = getenv("XDG_RUNTIME_DIR");
+
+	memset(addr, 0, sizeof(struct sockaddr_un));
+	addr->sun_family = AF_UNIX;
+	if ( rd && *rd )
+		snprintf(addr->sun_path, sizeof(addr->sun_path), "%s/notes.sock", rd);
+	else
+		snprintf(addr->sun_path, sizeof(addr->sun_path), "/tmp/notes-%d.sock", (int) getuid());
+	return socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	}
+
+// true if the other end of the socket runs as our user; the socket may be in
+// /tmp, where anyone can create it first
+static bool srv_peer_ok(int fd) {
+	struct ucred cr;
+	socklen_t	len = sizeof(cr);
+
+	return getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cr, &len) == 0 && cr.uid == getuid();
+	}
+
+// connect to the service; returns the socket or -1 if it is not running
+int srv_connect() {
+	struct sockaddr_un addr;
+	int		fd = srv_socket(&addr);
+	
+	if ( fd >= 0 && (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0 || !srv_peer_ok(fd)) ) {
+		close(fd);
+		fd = -1;
+		}
+	return fd;
+	}
+
+// read a line of reply, without the new-line
+static bool srv_readln(int fd, char *buf, size_t size) {
+	size_t	n = 0;
+	ssize_t	r;
+	
+	while ( n < size - 1 ) {
+		if ( (r = read(fd, buf + n, 1)) <= 0 ) {
+			if ( r < 0 && errno == EINTR ) continue;
+			break;
+			}
+		if ( buf[n] == '\n' ) {
+			buf[n] = '\0';
+			return true;
+			}
+		n ++;
+		}
+	buf[n] = '\0';
+	return false;
+	}
+
+// print the "ERR <errno> <file>" reply
+static void srv_perror(const char *reply) {
+	int		err = atoi(reply + 4);
+	const char *file = strchr(reply + 4, ' ');
+
+	file = (file) ? file + 1 : "";
+	if ( err == ENOENT )
+		fprintf(stderr, "File '%s' does not exist.\nUse '!' option to create it.\n", file);
+	else
+		fprintf(stderr, "%s: errno %d: %s\n", file, err, strerror(err));
+	}
+
+// -a+ through the service; returns -1 if the service is not running or it
+// serves another notebook, otherwise the exit code. It runs after init(): the
+// notebook, the clobber setting and the rules of -e come from the rc file.
+int srv_append(const char *name, const char *section, list_node_t *files) {
+	char	buf[SRV_MAXHDR], file[PATH_MAX];
+	int		fd, n, exit_code = EXIT_FAILURE;
+	
+	if ( strpbrk(name, "\t\n") || strpbrk(section, "\t\n") )
+		return -1;
+	if ( (fd = srv_connect()) < 0 )
+		return -1;
+	signal(SIGPIPE, SIG_IGN);
+	n = snprintf(buf, sizeof(buf), "A\t%s\t%s\t%s\t%d\n", ndir, section, name, (opt_flags & OPT_NOCLOB) ? 1 : 0);
+	if ( n >= sizeof(buf) || !write_all(fd, buf, n) || !srv_readln(fd, buf, sizeof(buf)) || strncmp(buf, "NB", 2) == 0 ) {
+		close(fd);
+		return -1;
+		}
+	if ( strncmp(buf, "GO ", 3) == 0 ) {
+		strcpy(file, buf + 3);
+		for ( ; files; files = files->next ) {
+			if ( print_file_to((const char *) files->data, fd, false) )
+				printf("* '%s' copied *\n", (const char *) files->data);
+			}
+		if ( opt_flags & OPT_STDIN ) // the '-' option used
+			print_file_to(NULL, fd, false);
+		shutdown(fd, SHUT_WR);
+		if ( srv_readln(fd, buf, sizeof(buf)) && strcmp(buf, "OK") == 0 )
+			exit_code = EXIT_SUCCESS;
+		else if ( strncmp(buf, "ERR ", 4) == 0 )
+			srv_perror(buf);
+		else
+			fprintf(stderr, "%s: the service did not acknowledge the append\n", file);
+		}
+	else
+		srv_perror(buf);
+	close(fd);
+	if ( exit_code == EXIT_SUCCESS && (opt_flags & OPT_EDIT) )  // the '-e' option used
+		rule_exec('e', file);
+	return exit_code;
+	}
+
+// send a query (type 'q') to the service and read the whole reply after "GO";
+// returns false if the service is not running or it serves another notebook
+static bool srv_request(int q, const char *section, const char *arg, sbuf_t *reply) {
+	char	buf[SRV_MAXHDR];
+	int		fd, n;
+	
+	if ( strchr(arg, '\n') || (section && strpbrk(section, "\t\n")) )
+		return false;
+	if ( (fd = srv_connect()) < 0 )
+		return false;
+	n = snprintf(buf, sizeof(buf), "%c\t%s\t%s\t%d\t%s\n", q, ndir, (section) ? section : "", (section) ? 1 : 0, arg);
+	if ( n >= sizeof(buf) || !write_all(fd, buf, n) || !srv_readln(fd, buf, sizeof(buf)) || strcmp(buf, "GO") != 0 ) {
+		close(fd);
+		return false;
+		}
+	sbuf_init(reply);
+	while ( (n = read(fd, buf, sizeof(buf))) != 0 ) {
+		if ( n < 0 ) {
+			if ( errno == EINTR ) continue;
+			break;
+			}
+		sbuf_addn(reply, buf, n);
+		}
+	close(fd);
+	if ( n < 0 )
+		sbuf_free(reply);
+	return (n == 0);
+	}
+
+// get the notes that match the pattern from the service, as dirwalk() does
+// (dirwalk_stop, dirwalk_nosub); returns false if the service is not running
+// or it serves another notebook
+bool srv_query(const char *pattern, const char *section) {
+	char	*p, *end;
+	sbuf_t	reply;
+	
+	if ( !srv_request('Q', section, pattern, &reply) )
+		return false;
+	for ( p = reply.ptr, end = p + reply.len; !dirwalk_stop && p < end; p += strlen(p) + 1 ) {
+		if ( *p == 'S' ) { // the subsections
+			if ( !dirwalk_nosub && list_findstr(sections, p + 1) == NULL )
+				list_addstr(sections, p + 1);
+			}
+		else if ( *p == 'F' )
+			dirwalk_addfile(p + 1);
+		}
+	sbuf_free(&reply);
+	return true;
+	}
+
+// watch the scanned directories that are not watched yet; returns true if
+// a directory changed between its scan and the watch (needs update)
+static bool srv_watch() {
+	struct stat st;
+	bool	stale = false;
+	
+	for ( list_node_t *cur = dirs->head; cur; cur = cur->next ) {
+		dirstat_t *ds = (dirstat_t *) cur->data;
+		if ( ds->wd < 0 ) {
+			ds->wd = inotify_add_watch(srv_ifd, ds->path,
+				IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR);
+			if ( stat(ds->path, &st) == 0 && (st.st_mtim.tv_sec != ds->mtime.tv_sec || st.st_mtim.tv_nsec != ds->mtime.tv_nsec) )
+				stale = true;
+			}
+		}
+	return stale;
+	}
+
+// qsort/bsearch callback
+static int wd_cmp(const void *a, const void *b) {
+	int wa = *(const int *) a, wb = *(const int *) b;
+	return (wa > wb) - (wa < wb);
+	}
+
+// read the pending events and update the catalog if something changed; the
+// directories of the watches that fired are rescanned even if their mtime
+// looks the same (changes within one timestamp tick)
+static void srv_catalog_update() {
+	char	buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+	ssize_t	n;
+	bool	overflow = false;
+	int		*wds = NULL;
+	size_t	nwd = 0, wdmax = 0;
+	
+	while ( (n = read(srv_ifd, buf, sizeof(buf))) > 0 ) {
+		for ( char *p = buf; p < buf + n; p += sizeof(struct inotify_event) + ((struct inotify_event *) p)->len ) {
+			struct inotify_event *ev = (struct inotify_event *) p;
+			if ( ev->mask & IN_Q_OVERFLOW )
+				overflow = true;
+			else if ( ev->wd >= 0 ) {
+				if ( nwd == wdmax )
+					wds = (int *) realloc(wds, sizeof(int) * (wdmax = (wdmax) ? wdmax * 2 : 64));
+				wds[nwd ++] = ev->wd;
+				}
+			}
+		}
+	if ( overflow ) { // events lost, rebuild
+		list_clear(notes);
+		list_clear(sections);
+		dirs_clear();
+		dirwalk(ndir);
+		}
+	else if ( nwd ) {
+		qsort(wds, nwd, sizeof(int), wd_cmp);
+		for ( list_node_t *cur = dirs->head; cur; cur = cur->next ) {
+			dirstat_t *ds = (dirstat_t *) cur->data;
+			if ( ds->wd >= 0 && bsearch(&ds->wd, wds, nwd, sizeof(int), wd_cmp) )
+				ds->mtime.tv_nsec = -1; // never matches, dirwalk_update() rescans it
+			}
+		dirwalk_update(NULL);
+		}
+	if ( overflow || nwd ) {
+		while ( srv_watch() )
+			dirwalk_update(NULL);
+		cx_stale = true;
+		}
+	free(wds);
+	}
+
+// close the connection and free the client
+static void srv_client_free(srv_client_t *c) {
+	close(c->fd);
+	sbuf_free(&c->buf);
+	sbuf_free(&c->out);
+	free(c);
+	}
+
+// send the queued reply; returns false when the client is finished (all sent
+// or broken) and freed, true if the rest waits for POLLOUT
+static bool srv_client_write(srv_client_t *c) {
+	ssize_t	w;
+	
+	while ( c->sent < c->out.len ) {
+		if ( (w = write(c->fd, c->out.ptr + c->sent, c->out.len - c->sent)) < 0 ) {
+			if ( errno == EINTR ) continue;
+			if ( errno == EAGAIN ) return true;
+			break;
+			}
+		c->sent += w;
+		}
+	srv_client_free(c);
+	return false;
+	}
+
+// answer a query; the notes that match are selected as main() does
+static void srv_query_reply(srv_client_t *c, const char *section, bool sectionf, const char *pattern) {
+	list_node_t	*cur;
+	note_t	*note;
+	sbuf_t	*reply = &c->out;
+	const char	*longest = "";
+	size_t	seclen = strlen(section);
+	
+	srv_catalog_update();
+	sbuf_add(reply, "GO\n");
+	for ( cur = notes->head; cur; cur = cur->next ) { // the sections that -s would scan
+		note = (note_t *) cur->data;
+		if ( sectionf && (strncmp(note->section, section, seclen) != 0 || (note->section[seclen] && note->section[seclen] != '/')) )
+			continue;
+		if ( strlen(note->section) > strlen(longest) )
+			longest = note->section;
+		}
+	sbuf_addc(reply, 'S');
+	sbuf_addn(reply, longest, strlen(longest) + 1);
+	for ( cur = notes->head; cur; cur = cur->next ) {
+		note = (note_t *) cur->data;
+		if ( sectionf && strcmp(section, note->section) != 0 )
+			continue;
+		if ( fnmatch(pattern, note->name, FNM_PERIOD | FNM_CASEFOLD | FNM_GLIBC_EXTRA) == 0 ) {
+			sbuf_addc(reply, 'F');
+			sbuf_addn(reply, note->file, strlen(note->file) + 1);
+			}
+		}
+	}
+
+// returns the cached descriptor of the note, opens it if needed
+static srv_note_t *srv_note_open(list_t *snotes, const char *file, bool create) {
+	srv_note_t	*sn;
+	int		fd;
+	
+	for ( list_node_t *cur = snotes->head; cur; cur = cur->next ) {
+		sn = (srv_note_t *) cur->data;
+		if ( strcmp(sn->file, file) == 0 )
+			return sn;
+		}
+	if ( (fd = open(file, O_WRONLY | O_CLOEXEC | ((create) ? O_CREAT : 0), 0666)) < 0 )
+		return NULL;
+	sn = (srv_note_t *) list_add(snotes, NULL, sizeof(srv_note_t))->data;
+	strcpy(sn->file, file);
+	sn->fd = fd;
+	sbuf_init(&sn->pend);
+	sn->acks = list_create();
+	sn->owner = NULL;
+	sn->dirty = false;
+	return sn;
+	}
+
+// append 'n' bytes to the note; the lock keeps the records of the
+// command-line appenders (append_lock) and ours apart. Returns EWOULDBLOCK
+// if an appender holds the lock, the caller keeps the data and retries.
+static int srv_note_write(srv_note_t *sn, const char *data, size_t n) {
+	struct stat st, fst;
+	int		err = 0;
+	
+	// renamed or deleted by someone else, reopen
+	if ( stat(sn->file, &st) != 0 || fstat(sn->fd, &fst) != 0 || st.st_ino != fst.st_ino || st.st_dev != fst.st_dev ) {
+		close(sn->fd);
+		if ( (sn->fd = open(sn->file, O_WRONLY | O_CREAT | O_CLOEXEC, 0666)) < 0 )
+			return errno;
+		}
+	while ( flock(sn->fd, (srv_wait) ? LOCK_EX : LOCK_EX | LOCK_NB) != 0 ) {
+		if ( errno != EINTR )
+			return errno;
+		}
+	lseek(sn->fd, 0, SEEK_END);
+	if ( !write_all(sn->fd, data, n) )
+		err = errno;
+	flock(sn->fd, LOCK_UN);
+	sn->dirty = true;
+	return err;
+	}
 
-							// report
-							if ( succ == 1 ) sprintf(status, "one note moved%c", ((fail)?';':'.'));
-							else sprintf(status, "%d notes moved%c", succ, ((fail)?';':'.'));
-							if ( fail ) sprintf(status+strlen(status), " %d failed.", fail);
+// acknowledge and close the client
+static void srv_ack(srv_client_t *c, int err) {
+	char	buf[SRV_MAXHDR];
+	
+	if ( err )
+		snprintf(buf, sizeof(buf), "ERR %d %s\n", err, (c->note) ? c->note->file : "");
+	else
+		strcpy(buf, "OK\n");
+	write_all(c->fd, buf, strlen(buf));
+	srv_client_free(c);
+	}
 
-							// cleanup
-							list_clear(tagged);
-							free(new_section);
-							}
-						}
-					
-					ex_rebuild();
-					ex_refresh();
-					}
-				break;
-	/*
-			case KEY_REFRESH:
-				ex_rebuild();
-				sprintf(status, "rebuilded.");
-				ex_refresh();
-				break;
-	*/
-			case 'f': // show in filemanager
-				{
-				char *fmans[] = { "xdg-open", "mc", "thunar", "dolphin", NULL };
-				int idx = nc_listbox("File Manager", (const char **) fmans, 0);
-				if ( idx > -1 ) {
-					ex_presh();
-					sprintf(buf, "%s '%s'", fmans[idx], ndir);
-					system(buf);
-					}
-				ex_refresh();
-				break;
+// the rest of the large record of the owner, then the group write of the
+// pending records of the note
+static void srv_note_flush(srv_note_t *sn) {
+	srv_client_t *c = (srv_client_t *) sn->owner;
+	int		err = 0;
+	
+	if ( c ) {
+		if ( !c->done || (err = srv_note_write(sn, c->buf.ptr, c->buf.len)) == EWOULDBLOCK )
+			return;
+		sn->owner = NULL;
+		srv_ack(c, err);
+		err = 0;
+		}
+	if ( sn->acks->head == NULL && sn->pend.len == 0 )
+		return;
+	if ( sn->pend.len && (err = srv_note_write(sn, sn->pend.ptr, sn->pend.len)) == EWOULDBLOCK )
+		return;
+	for ( list_node_t *cur = sn->acks->head; cur; cur = cur->next )
+		srv_ack((srv_client_t *) cur->data, err);
+	list_clear(sn->acks);
+	sbuf_clear(&sn->pend);
+	}
+
+// the header of the request is received; resolve the note and reply. Returns
+// false if the request is answered: the reply is queued in c->out.
+static bool srv_header(srv_client_t *c, list_t *snotes) {
+	char	*f[5], *p, *eol, reply[SRV_MAXHDR], dir[PATH_MAX];
+	int		n = 0, err = 0;
+	note_t	*note;
+	bool	exists;
+	
+	eol = strchr(c->buf.ptr, '\n');
+	*eol = '\0';
+	for ( p = c->buf.ptr; n < 5 && p; n ++ ) { // the last field is the rest of the line
+		f[n] = p;
+		if ( n < 4 && (p = strchr(p, '\t')) != NULL )
+			*p ++ = '\0';
+		}
+	if ( n != 5 || !p || (strcmp(f[0], "A") != 0 && strcmp(f[0], "Q") != 0 && strcmp(f[0], "C") != 0)
+			|| strlen(f[2]) >= NAME_MAX || strlen(f[3]) >= NAME_MAX || *f[3] == '\0' ) {
+		sbuf_add(&c->out, "ERR 22 request\n");
+		return false;
+		}
+	if ( strcmp(f[1], ndir) != 0 ) {
+		sbuf_add(&c->out, "NB\n");
+		return false;
+		}
+	if ( *f[0] == 'Q' ) {
+		srv_query_reply(c, f[2], (*f[3] == '1'), f[4]);
+		return false;
+		}
+	if ( *f[0] == 'C' ) {
+		srv_catalog_update();
+		sbuf_add(&c->out, "GO\n");
+		cx_list(f[4], (*f[3] == '1') ? f[2] : NULL, &c->out);
+		return false;
+		}
+	// only the path, the section is created if the client may create the note
+	if ( (note = make_note(f[3], f[2], 0x02)) == NULL )
+		err = errno;
+	else {
+		exists = (access(note->file, F_OK) == 0);
+		if ( !exists && *f[4] != '1' )
+			err = ENOENT;
+		else if ( !exists && strlen(note->section) ) {
+			snprintf(dir, PATH_MAX, "%s/%s", ndir, note->section);
+			err = make_dirs(dir);
+			}
+		if ( err == 0 ) {
+			if ( (c->note = srv_note_open(snotes, note->file, true)) == NULL )
+				err = errno;
+			else if ( !exists ) {
+				dirwalk_addfile(note->file); // a new section name is in the catalog now
+				cx_stale = true;
 				}
-			case KEY_DC: // delete
-				if ( t_notes_count ) {
-					strcpy(buf, "");
-					if ( list_count(tagged) )
-						sprintf(prompt, "Delete all tagged notes ?");
-					else
-						sprintf(prompt, "Do you want to delete '%s' ?", t_notes[pos]->name);
-					
-					if ( ex_input(buf, "%s", prompt) && istrue(buf) ) {
-						if ( !list_count(tagged) )
-							list_addptr(tagged, t_notes[pos]);
-						int succ = 0, fail = 0;
-						for ( list_node_t *cur = tagged->head; cur; cur = cur->next )
-							(note_delete(cur->data)) ? succ ++ : fail ++;
-						if ( succ == 1 ) sprintf(status, "one note deleted%c", ((fail)?';':'.'));
-						else sprintf(status, "%d notes deleted%c", succ, ((fail)?';':'.'));
-						if ( fail ) sprintf(status+strlen(status), " %d failed.", fail);
-						
-						list_clear(tagged);
-						ex_rebuild();
-						if ( t_notes_count ) {
-							if ( pos >= t_notes_count )
-								pos = t_notes_count - 1;
-							}
-						else
-							offset = pos = 0;
-						}
-					ex_refresh();
-					}
-				break;
-			case 'r':	// rename
-				if ( t_notes_count ) {
-					strcpy(buf, t_notes[pos]->name);
-					if ( ex_input(buf, "Enter the new name ([section/]new-name[.extension])", t_notes[pos]->name)
-							&& strlen(buf)
-							&& strcmp(buf, t_notes[pos]->name) != 0 ) {
-						note_backup(t_notes[pos]);
-						note_t *nn = make_note(buf, t_notes[pos]->section, 1);
-						if ( !copy_file(t_notes[pos]->file, nn->file) )
-							sprintf(status, "copy failed");
-						else {
-							if ( remove(t_notes[pos]->file) != 0 )
-								sprintf(status, "delete old note failed");
-							}
-						free(nn);
-						ex_rebuild();
-						if ( (pos = ex_find(buf)) == -1 ) pos = 0;
-						}
-					ex_refresh();
-					}
-				break;
-			case 'm':
-				if ( t_notes_count && umenu->head ) {
-					int idx;
-					umenu_item_t **opts;
-					
-					opts = (umenu_item_t **) list_to_table(umenu);
-					if ( (idx = nc_listbox("User Menu", (const char **) opts, 0)) > -1 ) {
-						int tcnt = list_count(tagged);
-						if ( !tcnt )
-							list_addptr(tagged, t_notes[pos]);
-						
-						ex_presh();
-						ex_tagged_shell(opts[idx]->cmd, tagged);
-						printf("\nPress any key to return...\n");
-						getch();
-						if ( !tcnt )
-							list_clear(tagged);
-						}
-					free(opts);
-					ex_refresh();
-					}
+			}
+		}
+	if ( err )
+		snprintf(reply, sizeof(reply), "ERR %d %s\n", err, (note) ? note->file : f[3]);
+	else
+		snprintf(reply, sizeof(reply), "GO %s\n", note->file);
+	free(note);
+	if ( err ) {
+		sbuf_add(&c->out, reply);
+		return false;
+		}
+	write_all(c->fd, reply, strlen(reply)); // the first write to the socket, it fits
+	
+	// keep the data after the header
+	n = c->buf.len - (eol + 1 - c->buf.ptr);
+	memmove(c->buf.ptr, eol + 1, n);
+	c->buf.len = n;
+	c->buf.ptr[n] = '\0';
+	return true;
+	}
+
+// read from the client; returns false if the client is finished
+static bool srv_client_read(srv_client_t *c, list_t *snotes) {
+	char	buf[COPY_BUFSZ];
+	ssize_t	n;
+	int		err;
+	srv_note_t *sn;
+	
+	while ( (n = read(c->fd, buf, sizeof(buf))) > 0 ) {
+		if ( c->buf.len == 0 )
+			clock_gettime(CLOCK_MONOTONIC, &c->since);
+		sbuf_addn(&c->buf, buf, n);
+		if ( c->note == NULL ) {
+			if ( memchr(c->buf.ptr, '\n', c->buf.len) == NULL ) {
+				if ( c->buf.len < SRV_MAXHDR ) continue;
+				srv_ack(c, EINVAL);
+				return false;
+				}
+			if ( !srv_header(c, snotes) ) // answered, send the reply
+				return srv_client_write(c);
+			}
+		
+		// a large record, write it while receiving if the note is free;
+		// it is kept in the buffer while an appender holds the lock
+		sn = c->note;
+		if ( c->buf.len >= SRV_DIRECT && sn->owner == NULL ) {
+			srv_note_flush(sn);
+			if ( sn->acks->head == NULL && sn->pend.len == 0 )
+				sn->owner = c;
+			}
+		if ( c->buf.len >= SRV_DIRECT && sn->owner == c ) {
+			if ( (err = srv_note_write(sn, c->buf.ptr, c->buf.len)) == EWOULDBLOCK )
+				continue;
+			if ( err ) {
+				sn->owner = NULL;
+				srv_ack(c, err);
+				return false;
+				}
+			sbuf_clear(&c->buf);
+			}
+		}
+	if ( n < 0 && (errno == EAGAIN || errno == EINTR) )
+		return true;
+	if ( n < 0 || c->note == NULL ) { // broken or no request
+		srv_client_free(c);
+		return false;
+		}
+	
+	// EOF, the record is complete
+	sn = c->note;
+	c->done = true;
+	if ( sn->owner == c )
+		srv_note_flush(sn);
+	else {
+		sbuf_addn(&sn->pend, c->buf.ptr, c->buf.len);
+		list_addptr(sn->acks, c);
+		}
+	return false;
+	}
+
+// the complete lines of a client that is still sending after SRV_STREAM_MS
+// (tail -f) are written without waiting for its EOF; the owner of the note
+// writes them, the others add them to the group write
+static void srv_client_stream(srv_client_t *c, const struct timespec *now) {
+	srv_note_t *sn = c->note;
+	char	*nl;
+	size_t	n;
+	
+	if ( sn == NULL || c->buf.len == 0 || srv_elapsed(&c->since, now) < SRV_STREAM_MS )
+		return;
+	if ( (nl = (char *) memrchr(c->buf.ptr, '\n', c->buf.len)) == NULL )
+		return;
+	n = nl + 1 - c->buf.ptr;
+	if ( sn->owner == c ) {
+		if ( srv_note_write(sn, c->buf.ptr, n) != 0 )
+			return; // retried, the error is replied at EOF
+		}
+	else if ( sn->owner == NULL )
+		sbuf_addn(&sn->pend, c->buf.ptr, n);
+	else
+		return;
+	c->buf.len -= n;
+	memmove(c->buf.ptr, nl + 1, c->buf.len);
+	c->buf.ptr[c->buf.len] = '\0';
+	c->since = *now;
+	}
+
+// write and sync everything; closes the idle descriptors if there are too many
+static void srv_sync(list_t *snotes, bool closeall) {
+	list_node_t *cur, *next;
+	srv_note_t	*sn;
+	bool	many = (list_count(snotes) > SRV_OPEN_MAX);
+
+	for ( cur = snotes->head; cur; cur = next ) {
+		next = cur->next;
+		sn = (srv_note_t *) cur->data;
+		srv_note_flush(sn);
+		if ( sn->dirty ) {
+			fdatasync(sn->fd);
+			sn->dirty = false;
+			}
+		else if ( (many || closeall) && sn->owner == NULL && sn->acks->head == NULL && sn->pend.len == 0 ) {
+			close(sn->fd);
+			sbuf_free(&sn->pend);
+			list_destroy(sn->acks);
+			list_delete(snotes, cur);
+			}
+		}
+	}
+
+// the service (--serve)
+int srv_main() {
+	struct sockaddr_un addr;
+	struct sigaction sa;
+	struct pollfd *pfd = NULL;
+	struct timespec now, synced;
+	list_t	*clients, *snotes;
+	list_node_t *cur, *next;
+	int		lfd, fd, npfd = 0, n, timeout;
+	
+	if ( (fd = srv_connect()) >= 0 ) {
+		fprintf(stderr, "the service is already running.\n");
+		close(fd);
+		return EXIT_FAILURE;
+		}
+	if ( (lfd = srv_socket(&addr)) < 0 ) {
+		fprintf(stderr, "socket: errno %d: %s\n", errno, strerror(errno));
+		return EXIT_FAILURE;
+		}
+	unlink(addr.sun_path); // stale
+	mode_t um = umask(077); // the socket only, the notes are created as by the command line
+	n = bind(lfd, (struct sockaddr *) &addr, sizeof(addr));
+	umask(um);
+	if ( n != 0 || listen(lfd, SOMAXCONN) != 0 ) {
+		fprintf(stderr, "%s: errno %d: %s\n", addr.sun_path, errno, strerror(errno));
+		close(lfd);
+		return EXIT_FAILURE;
+		}
+	fcntl(lfd, F_SETFL, O_NONBLOCK);
+	
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = srv_signal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	dirwalk(ndir); // the catalog
+	if ( (srv_ifd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) < 0 ) {
+		fprintf(stderr, "inotify: errno %d: %s\n", errno, strerror(errno));
+		close(lfd);
+		unlink(addr.sun_path);
+		return EXIT_FAILURE;
+		}
+	while ( srv_watch() )
+		dirwalk_update(NULL);
+	cx_build();
+	clients = list_create();
+	snotes = list_create();
+	clock_gettime(CLOCK_MONOTONIC, &synced);
+	while ( !srv_quit ) {
+		n = list_count(clients) + 2;
+		if ( n > npfd )
+			pfd = (struct pollfd *) realloc(pfd, sizeof(struct pollfd) * (npfd = n * 2));
+		pfd[0].fd = lfd;
+		pfd[0].events = POLLIN;
+		pfd[1].fd = srv_ifd;
+		pfd[1].events = POLLIN;
+		n = 2;
+		for ( cur = clients->head; cur; cur = cur->next, n ++ ) {
+			srv_client_t *c = (srv_client_t *) cur->data;
+			pfd[n].fd = c->fd;
+			pfd[n].events = ( c->out.len ) ? POLLOUT : POLLIN; // a reply to send or a request
+			}
+		
+		// wake up to sync, if there are unsynced writes, to retry the writes
+		// to locked notes and to write the lines of the streams
+		timeout = -1;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		for ( cur = snotes->head; cur; cur = cur->next )
+			if ( ((srv_note_t *) cur->data)->dirty ) {
+				timeout = SRV_SYNC_MS - srv_elapsed(&synced, &now);
+				if ( timeout < 0 ) timeout = 0;
 				break;
-			case '!':
-				if ( t_notes_count ) {
-					char	cmd[LINE_MAX];
-					strcpy(cmd, "");
-					if ( ex_input(cmd, "Enter command (use '%%f' for files)") && strlen(cmd) ) {
-						int tcnt = list_count(tagged);
-						if ( !tcnt )
-							list_addptr(tagged, t_notes[pos]);
-						ex_presh();
-						ex_tagged_shell(cmd, tagged);
-						printf("\nPress any key to return...\n");
-						getch();
-						if ( !tcnt )
-							list_clear(tagged);
-						}
-					ex_refresh();
-					}
+				}
+		for ( cur = snotes->head; cur; cur = cur->next ) {
+			srv_note_t *sn = (srv_note_t *) cur->data;
+			if ( sn->acks->head || sn->pend.len || (sn->owner && ((srv_client_t *) sn->owner)->done) ) {
+				timeout = ( timeout < 0 ) ? SRV_RETRY_MS : MIN(timeout, SRV_RETRY_MS);
 				break;
-			case 'a':
-			case 'n':
-				strcpy(buf, "");
-				if ( ex_input(buf, "Enter new name ([section/]new-name[.extension])") && strlen(buf) ) {
-					note_t *note = make_note(buf, current_section, (ch == KEY_CREATE) ? 0 : 1);
-					if ( note ) {
-						sprintf(status, "'%s' created", note->name);
-						ex_rebuild();
-						if ( (pos = ex_find(note->name)) == -1 ) pos = 0;
-						if ( ch == 'n' ) { // 'new' key invokes the editor, 'add' key do not
-							ex_presh();
-							rule_exec('e', note->file);
-							}
-						free(note);
-						}
-					else
-						sprintf(status, "failed: errno (%d) %s", errno, strerror(errno));
+				}
+			}
+		for ( cur = clients->head; cur; cur = cur->next ) {
+			srv_client_t *c = (srv_client_t *) cur->data;
+			if ( c->note && (c->note->owner == NULL || c->note->owner == c)
+					&& c->buf.len && memchr(c->buf.ptr, '\n', c->buf.len) ) {
+				int t = SRV_STREAM_MS - srv_elapsed(&c->since, &now);
+				if ( t <= 0 ) t = SRV_RETRY_MS; // the note was locked
+				timeout = ( timeout < 0 ) ? t : MIN(timeout, t);
+				}
+			}
+		if ( poll(pfd, n, timeout) < 0 && errno != EINTR )
+			break;
+		
+		if ( pfd[1].revents & POLLIN )
+			srv_catalog_update();
+		
+		// send the replies, receive everything that is ready, then write once per note
+		n = 2;
+		for ( cur = clients->head; cur; cur = next, n ++ ) {
+			srv_client_t *c = (srv_client_t *) cur->data;
+			next = cur->next;
+			if ( pfd[n].revents && !(( c->out.len ) ? srv_client_write(c) : srv_client_read(c, snotes)) )
+				list_delete(clients, cur);
+			}
+		if ( pfd[0].revents & POLLIN ) {
+			while ( (fd = accept4(lfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0 ) {
+				if ( !srv_peer_ok(fd) ) {
+					close(fd);
+					continue;
 					}
-				ex_refresh();
-				break;
+				srv_client_t *c = (srv_client_t *) malloc(sizeof(srv_client_t));
+				c->fd = fd;
+				sbuf_init(&c->buf);
+				sbuf_init(&c->out);
+				c->sent = 0;
+				c->note = NULL;
+				c->done = false;
+				if ( srv_client_read(c, snotes) )
+					list_addptr(clients, c);
 				}
 			}
-		} while ( !exitf );
-	nc_close();
-	tagged = list_destroy(tagged);
-	free(t_notes);
-	if ( strlen(onexit_cmd) )
-		system(onexit_cmd);
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		for ( cur = clients->head; cur; cur = cur->next )
+			srv_client_stream((srv_client_t *) cur->data, &now);
+		for ( cur = snotes->head; cur; cur = cur->next )
+			srv_note_flush((srv_note_t *) cur->data);
+		
+		if ( srv_elapsed(&synced, &now) >= SRV_SYNC_MS ) {
+			srv_sync(snotes, false);
+			synced = now;
+			}
+		}
+	
+	// the unfinished clients are dropped, the completed records are written
+	srv_wait = true;
+	for ( cur = clients->head; cur; cur = cur->next ) {
+		srv_client_t *c = (srv_client_t *) cur->data;
+		if ( c->note && c->note->owner == c )
+			c->note->owner = NULL;
+		srv_client_free(c);
+		}
+	srv_sync(snotes, true);
+	srv_sync(snotes, true);
+	list_destroy(clients);
+	list_destroy(snotes);
+	free(pfd);
+	close(srv_ifd);
+	close(lfd);
+	unlink(addr.sun_path);
+	return EXIT_SUCCESS;
+	}
+
+// === completion mode ===
+
+// mode --complete
+int note_complete(const char *word, const char *section) {
+	sbuf_t	out;
+	char	path[PATH_MAX];
+	
+	if ( !srv_request('C', section, word, &out) ) {
+		if ( section ) {
+			snprintf(path, PATH_MAX, "%s/%s", ndir, section);
+			dirwalk(path);
+			}
+		else
+			dirwalk(ndir);
+		sbuf_init(&out);
+		cx_list(word, section, &out);
+		}
+	int exit_code = (out.len) ? EXIT_SUCCESS : EXIT_FAILURE;
+	fwrite(out.ptr, out.len, 1, stdout);
+	sbuf_free(&out);
+	return exit_code;
 	}
 
 // === main =================================================================
@@ -1544,6 +4433,7 @@ void init() {
 	umenu = list_create();
 	notes = list_create();
 	sections = list_create();
+	dirs = list_create();
 	
 	// default values
 	strcpy(default_ftype, "txt");
@@ -1605,6 +4495,11 @@ void cleanup() {
 	umenu = list_destroy(umenu);
 	notes = list_destroy(notes);
 	sections = list_destroy(sections);
+	dirs_clear();
+	dirs = list_destroy(dirs);
+	free(dirs_index);
+	dirs_index = NULL;
+	dirs_slots = 0;
 	}
 
 #define APP_DESCR \
@@ -1630,18 +4525,23 @@ Modes:\n\
 \n\
 Options:\n\
     -s, --section  define section\n\
+    --limit N      stop after N notes are found (also --limit=N)\n\
+    --format=FMT   output format of -l and -f: text, json (one object per line), tsv or nul\n\
     -a, --all      displays all matching files; use it with -p, -v or -e\n\
     -              input from stdin\n\
 \n\
 Utilities:\n\
     --onstart      executes the 'onstart' command and returns its exit code\n\
     --onexit       executes the 'onexit' command and returns its exit code\n\
+    --history      lists the backups of the note[s]\n\
+    --restore      restores the last or the specified (by number) backup of a note\n\
+    --serve        runs the notes service; the other modes use it when it is running\n\
+    --complete     lists the names and sections that start with the word (completion)\n\
 \n\
     -h, --help     this screen\n\
     --version      version and program information\n\
 ";
 //    WIP --cleanup      removes empty sections\n
-//    WIP --complete     list notes for scripts (completion code)\n
 
 static const char *verss = "\
 notes version "APP_VER"\n\
@@ -1663,7 +4563,8 @@ int main(int argc, char *argv[]) {
 	note_t	*note;
 	list_node_t *cur_arg = NULL;
 	bool	sectionf = false;
-	char	tmp[LINE_MAX];
+	char	tmp[LINE_MAX], limit[LINE_MAX] = "", *e;
+	bool	limitf = false;
 
 	setlocale(LC_ALL, "");
 
@@ -1718,13 +4619,34 @@ int main(int argc, char *argv[]) {
 					else if ( strcmp(argv[i], "--files") == 0 )		{ opt_flags |= OPT_FILES; }
 					else if ( strcmp(argv[i], "--delete") == 0 )	{ opt_flags = OPT_DEL; }
 					else if ( strcmp(argv[i], "--rename") == 0 )	{ opt_flags = OPT_MOVE; }
+					else if ( strcmp(argv[i], "--history") == 0 )	{ opt_flags = OPT_HIST; }
+					else if ( strcmp(argv[i], "--restore") == 0 )	{ opt_flags = OPT_REST; }
 					else if ( strcmp(argv[i], "--complete") == 0 )	{ opt_flags = OPT_COMPL; }
 					else if ( strcmp(argv[i], "--section") == 0 )	{ asw = current_section; sectionf = true; }
+					else if ( strcmp(argv[i], "--limit") == 0 )		{ asw = limit; limitf = true; }
+					else if ( strncmp(argv[i], "--limit=", 8) == 0 )	{ snprintf(limit, LINE_MAX, "%s", argv[i] + 8); limitf = true; }
+					else if ( strncmp(argv[i], "--format=", 9) == 0 ) {
+						const char *fmt = argv[i] + 9;
+						if ( strcmp(fmt, "text") == 0 )			pl_format = PL_TEXT;
+						else if ( strcmp(fmt, "json") == 0 )	pl_format = PL_JSON;
+						else if ( strcmp(fmt, "tsv") == 0 )		pl_format = PL_TSV;
+						else if ( strcmp(fmt, "nul") == 0 )		pl_format = PL_NUL;
+						else {
+							fprintf(stderr, "unknown format [%s]\n", fmt);
+							return exit_code;
+							}
+						}
 					else if ( strcmp(argv[i], "--help") == 0 )		{ puts(usage); return exit_code; }
 					else if ( strcmp(argv[i], "--version") == 0 )	{ puts(verss); return exit_code; }
-					else if ( strcmp(argv[i], "--onstart") == 0 )	{ if ( strlen(onstart_cmd) ) return system(onstart_cmd); }
-					else if ( strcmp(argv[i], "--onexit") == 0 )	{ if ( strlen(onexit_cmd) ) return system(onexit_cmd); }
-					return exit_code;
+					else if ( strcmp(argv[i], "--onstart") == 0 )	{ if ( strlen(onstart_cmd) ) return WEXITSTATUS(sh_exec(onstart_cmd)); }
+					else if ( strcmp(argv[i], "--onexit") == 0 )	{ if ( strlen(onexit_cmd) ) return WEXITSTATUS(sh_exec(onexit_cmd)); }
+					else if ( strcmp(argv[i], "--serve") == 0 )		{ return srv_main(); }
+					else {
+						fprintf(stderr, "unknown option [%s]\n", argv[i]);
+						return exit_code;
+						}
+					j = strlen(argv[i]) - 1; // we finished with this argv
+					break;
 				default:
 					fprintf(stderr, "unknown option [%c]\n", argv[i][j]);
 					return exit_code;
@@ -1744,16 +4666,26 @@ int main(int argc, char *argv[]) {
 	//
 	if ( !g_globber )
 		opt_flags |= OPT_NOCLOB;
+	if ( limitf ) { // digits only, 0 = no limit
+		errno = 0;
+		opt_limit = strtoul(limit, &e, 10);
+		if ( !isdigit(limit[0]) || *e || errno == ERANGE )
+			{ printf("usage: notes --limit N (N >= 0)\n"); exit(EXIT_FAILURE); }
+		}
 
 	// no parameters
 	if ( args->head == NULL ) {
 		if ( opt_flags & OPT_LIST )
 			list_addstr(args, "*");
+		else if ( opt_flags & OPT_COMPL )
+			list_addstr(args, "");
 		else {
 			if ( opt_flags & OPT_ADD )		{ printf("usage: notes -a new-note-name\n"); exit(EXIT_FAILURE); }
 			if ( opt_flags & OPT_APPD )		{ printf("usage: notes -a+ note-name\n"); exit(EXIT_FAILURE); }
 			if ( opt_flags & OPT_DEL )		{ printf("usage: notes -d note-name\n"); exit(EXIT_FAILURE); }
 			if ( opt_flags & OPT_MOVE )		{ printf("usage: notes -r note-name new-note-name\n"); exit(EXIT_FAILURE); }
+			if ( opt_flags & OPT_HIST )		{ printf("usage: notes --history note-name\n"); exit(EXIT_FAILURE); }
+			if ( opt_flags & OPT_REST )		{ printf("usage: notes --restore note-name [record]\n"); exit(EXIT_FAILURE); }
 			
 			// default action with no parameters: run explorer
 			explorer(); 
@@ -1762,13 +4694,38 @@ int main(int argc, char *argv[]) {
 		}
 	cur_arg = args->head;
 
-	if ( opt_flags & OPT_ADD ) {
+	if ( opt_flags & OPT_COMPL ) {
+		//
+		//	completion, $1 is the partial [section/]name
+		//
+		exit_code = note_complete((const char *) cur_arg->data, (sectionf) ? current_section : NULL);
+		}
+	else if ( opt_flags & (OPT_HIST | OPT_REST) ) {
+		//
+		//	backups of a note, $1 is the note pattern, $2 the record number
+		//
+		if ( strlen(bdir) == 0 )
+			fprintf(stderr, "backup directory is not defined.\n");
+		else if ( opt_flags & OPT_HIST )
+			exit_code = note_history((const char *) cur_arg->data, (sectionf) ? current_section : NULL);
+		else
+			exit_code = note_restore((const char *) cur_arg->data, (sectionf) ? current_section : NULL,
+				(cur_arg->next) ? (const char *) cur_arg->next->data : NULL);
+		}
+	else if ( (opt_flags & (OPT_ADD | OPT_APPD)) == (OPT_ADD | OPT_APPD)
+			&& (i = srv_append((const char *) cur_arg->data, current_section, cur_arg->next)) >= 0 ) {
+		//
+		//	appended by the service (--serve)
+		//
+		exit_code = i;
+		}
+	else if ( opt_flags & OPT_ADD ) {
 		//
 		//	create/append note, $1 is the name
 		//
 		char	*name = (char *) cur_arg->data;
 		note_t	*note;
-		FILE	*fp;
+		int		fd;
 			
 		note = make_note(name, current_section, 0);
 		if ( !(opt_flags & OPT_NOCLOB ) ) {
@@ -1787,18 +4744,28 @@ int main(int argc, char *argv[]) {
 			}
 		
 		if ( note ) {
-			// create / truncate / open-for-append file
-			if ( (fp = fopen(note->file, ((opt_flags & OPT_APPD) ? "a" : "w"))) != NULL ) {
+			// create / truncate / open-for-append file;
+			// with append_lock each record is written under an exclusive lock, so
+			// the records of concurrent appenders do not interleave; it also allows
+			// copy_file_range that does not work with O_APPEND.
+			bool	lock = (opt_flags & OPT_APPD) && (strlen(append_lock) == 0 || istrue(append_lock));
+			int		flags = O_WRONLY | O_CREAT | O_CLOEXEC;
+			
+			if ( opt_flags & OPT_APPD )
+				flags |= (lock) ? 0 : O_APPEND;
+			else
+				flags |= O_TRUNC;
+			if ( (fd = open(note->file, flags, 0666)) >= 0 ) {
 				exit_code = EXIT_SUCCESS;
 				cur_arg = cur_arg->next;
 				while ( cur_arg ) {
-					if ( print_file_to((const char *) cur_arg->data, fp) )
+					if ( print_file_to((const char *) cur_arg->data, fd, lock) )
 						printf("* '%s' copied *\n", (const char *) cur_arg->data);
 					cur_arg = cur_arg->next;
 					}
 				if ( opt_flags & OPT_STDIN ) // the '-' option used
-					print_file_to(NULL, fp);
-				fclose(fp);
+					print_file_to(NULL, fd, lock);
+				close(fd);
 				if ( opt_flags & OPT_EDIT )  // the '-e' option used
 					rule_exec('e', note->file);
 				}
@@ -1814,8 +4781,27 @@ int main(int argc, char *argv[]) {
 		//	$1 is the note pattern, find note and do .. whatever
 		//	
 		
-		// create list of files
-		if ( sectionf ) {
+		// the lists that do not need widths are printed while walking;
+		// the modes that use only the first note stop at the first match
+		const char *note_pat = (const char *) cur_arg->data;
+		pl_pattern = note_pat;
+		pl_section = (sectionf) ? current_section : NULL;
+		pl_limit = opt_limit;
+		if ( (opt_flags & (OPT_LIST | OPT_FILES)) && !(opt_flags & (OPT_VIEW | OPT_EDIT | OPT_DEL | OPT_MOVE))
+				&& (pl_format != PL_TEXT || (opt_flags & OPT_FILES)) )
+			dirwalk_sink = note_pl_match;
+		else {
+			if ( (opt_flags & (OPT_VIEW | OPT_EDIT | OPT_MOVE)) && !(opt_flags & OPT_ALL) )
+				pl_limit = 1;
+			if ( pl_limit )
+				dirwalk_sink = note_add_match;
+			}
+		dirwalk_nosub = sectionf; // the notes of the subsections are not used
+		
+		// create list of files; the service (--serve) has them already
+		if ( srv_query((const char *) cur_arg->data, (sectionf) ? current_section : NULL) )
+			;
+		else if ( sectionf ) {
 			char path[PATH_MAX];
 			snprintf(path, PATH_MAX, "%s/%s", ndir, current_section);
 			dirwalk(path);
@@ -1823,9 +4809,22 @@ int main(int argc, char *argv[]) {
 		else
 			dirwalk(ndir);
 
+		dirwalk_nosub = dirwalk_stop = false;
+		if ( dirwalk_sink == note_pl_match ) {
+			dirwalk_sink = NULL;
+			if ( pl_count && !(opt_flags & OPT_FILES) )
+				exit_code = EXIT_SUCCESS;
+			else if ( pl_count == 0 && !(opt_flags & OPT_FILES) )
+				fprintf(stderr, "* no notes found *\n");
+			args = list_destroy(args);
+			cleanup();
+			return exit_code;
+			}
+		
 		// get list of notes according the pattern (argv)
-		const char *note_pat = (const char *) cur_arg->data;
+		dirwalk_sink = NULL;
 		cur_arg = cur_arg->next;
+		note_pl_width();
 		list_t *res = list_create(); // list of results
 		for ( list_node_t *np = notes->head; np; np = np->next ) {
 			note = (note_t *) np->data;
@@ -1846,6 +4845,8 @@ int main(int argc, char *argv[]) {
 		size_t res_count = list_count(res);
 		if ( !(opt_flags & OPT_FILES) && res_count ) {
 			list_node_t *cur = res->head;
+			list_node_t *ahead = NULL;	// read-ahead of the next notes (--print --all)
+			int		nahead = 0;
 			
 			exit_code = EXIT_SUCCESS;
 			if ( (opt_flags == OPT_AUTO) && res_count == 1 )
@@ -1855,15 +4856,23 @@ int main(int argc, char *argv[]) {
 				note = (note_t *) cur->data;
 				
 				if ( (opt_flags & OPT_VIEW) || (opt_flags & OPT_EDIT) ) {
-					int action = 'v';
 					if ( opt_flags & OPT_EDIT ) {
-						action = 'e';
-						note_backup(note);
+						fprint_t fp;
+						note_edit_begin(note, &fp);
+						rule_exec('e', note->file);
+						note_edit_end(note, &fp);
 						}
-					if ( opt_flags & OPT_PRINT )
+					else if ( opt_flags & OPT_PRINT ) {
+						if ( opt_flags & OPT_ALL ) {
+							if ( nahead > 0 )	nahead --; // this one was in
+							else				ahead = cur->next;
+							for ( ; ahead && nahead < PRINT_AHEAD; ahead = ahead->next, nahead ++ )
+								note_readahead((const note_t *) ahead->data);
+							}
 						note_print(note);
+						}
 					else 
-						rule_exec(action, note->file);
+						rule_exec('v', note->file);
 					if ( (opt_flags & OPT_ALL) == 0 )
 						break;
 					}
@@ -1892,11 +4901,14 @@ int main(int argc, char *argv[]) {
 							strcat(new_file, ".");
 							strcat(new_file, ext);
 							}
-						if ( rename(note->file, new_file) == 0 )
+						int err = move_file(note->file, new_file, (opt_flags & OPT_NOCLOB));
+						if ( err == 0 )
 							printf("* '%s' -> '%s' succeed *\n", note->name, arg);
+						else if ( err == EEXIST )
+							fprintf(stderr, "File '%s' already exist.\nUse '!' option to replace it.\n", new_file);
 						else
 							fprintf(stderr, "rename failed:\n[%s] -> [%s]\nerrno %d: %s\n",
-								note->file, new_file, errno, strerror(errno));
+								note->file, new_file, err, strerror(err));
 						}
 					break; // only one file
 					}
@@ -0,0 +1,121 @@
+/*
+ *	SHA-256 message digest (FIPS 180-4)
+ * 
+ *	Copyright (C) 2026 the notes contributors.
+ *
+ *	This is free software: you can redistribute it and/or modify it under
+ *	the terms of the GNU General Public License as published by the
+ *	Free Software Foundation, either version 3 of the License, or (at your
+ *	option) any later version.
+ *
+ *	It is distributed in the hope that it will be useful, but WITHOUT ANY
+ *	WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ *	FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ *	for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with it. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include "sha256.h"
+
+static const uint32_t k[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2 };
+
+#define ROR(x,n)	(((x) >> (n)) | ((x) << (32 - (n))))
+
+// process one 64 bytes block
+static void sha256_block(sha256_t *ctx, const uint8_t *p) {
+	uint32_t	w[64], a, b, c, d, e, f, g, h, t1, t2;
+	int			i;
+
+	for ( i = 0; i < 16; i ++, p += 4 )
+		w[i] = ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) | ((uint32_t) p[2] << 8) | p[3];
+	for ( ; i < 64; i ++ )
+		w[i] = (ROR(w[i-2], 17) ^ ROR(w[i-2], 19) ^ (w[i-2] >> 10)) + w[i-7]
+			+ (ROR(w[i-15], 7) ^ ROR(w[i-15], 18) ^ (w[i-15] >> 3)) + w[i-16];
+
+	a = ctx->state[0]; b = ctx->state[1]; c = ctx->state[2]; d = ctx->state[3];
+	e = ctx->state[4]; f = ctx->state[5]; g = ctx->state[6]; h = ctx->state[7];
+	for ( i = 0; i < 64; i ++ ) {
+		t1 = h + (ROR(e, 6) ^ ROR(e, 11) ^ ROR(e, 25)) + ((e & f) ^ (~e & g)) + k[i] + w[i];
+		t2 = (ROR(a, 2) ^ ROR(a, 13) ^ ROR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+		h = g; g = f; f = e; e = d + t1;
+		d = c; c = b; b = a; a = t1 + t2;
+		}
+	ctx->state[0] += a; ctx->state[1] += b; ctx->state[2] += c; ctx->state[3] += d;
+	ctx->state[4] += e; ctx->state[5] += f; ctx->state[6] += g; ctx->state[7] += h;
+	}
+
+//
+void sha256_init(sha256_t *ctx) {
+	static const uint32_t h0[8] = {
+		0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 };
+	memcpy(ctx->state, h0, sizeof(h0));
+	ctx->count = 0;
+	}
+
+//
+void sha256_update(sha256_t *ctx, const void *data, size_t len) {
+	const uint8_t *p = (const uint8_t *) data;
+	size_t	used = ctx->count & 63, n;
+
+	ctx->count += len;
+	if ( used ) { // fill the pending block
+		n = 64 - used;
+		if ( len < n ) {
+			memcpy(ctx->buf + used, p, len);
+			return;
+			}
+		memcpy(ctx->buf + used, p, n);
+		sha256_block(ctx, ctx->buf);
+		p += n; len -= n;
+		}
+	for ( ; len >= 64; p += 64, len -= 64 )
+		sha256_block(ctx, p);
+	memcpy(ctx->buf, p, len);
+	}
+
+//
+void sha256_final(sha256_t *ctx, uint8_t digest[SHA256_SIZE]) {
+	uint64_t	bits = ctx->count << 3;
+	size_t		used = ctx->count & 63;
+	int			i;
+
+	ctx->buf[used ++] = 0x80;
+	if ( used > 56 ) {
+		memset(ctx->buf + used, 0, 64 - used);
+		sha256_block(ctx, ctx->buf);
+		used = 0;
+		}
+	memset(ctx->buf + used, 0, 56 - used);
+	for ( i = 0; i < 8; i ++ )
+		ctx->buf[56 + i] = (uint8_t) (bits >> (56 - i * 8));
+	sha256_block(ctx, ctx->buf);
+	for ( i = 0; i < 8; i ++ ) {
+		digest[i*4]   = (uint8_t) (ctx->state[i] >> 24);
+		digest[i*4+1] = (uint8_t) (ctx->state[i] >> 16);
+		digest[i*4+2] = (uint8_t) (ctx->state[i] >> 8);
+		digest[i*4+3] = (uint8_t) ctx->state[i];
+		}
+	}
+
+//
+char *sha256_hex(const uint8_t digest[SHA256_SIZE], char *hex) {
+	static const char hd[] = "0123456789abcdef";
+	for ( int i = 0; i < SHA256_SIZE; i ++ ) {
+		hex[i*2]   = hd[digest[i] >> 4];
+		hex[i*2+1] = hd[digest[i] & 0xF];
+		}
+	hex[SHA256_HEXSIZE] = '\0';
+	return hex;
+	}
+
@@ -0,0 +1,51 @@
+/*
+ *	SHA-256 message digest (FIPS 180-4)
+ * 
+ *	Copyright (C) 2026 the notes contributors.
+ *
+ *	This is free software: you can redistribute it and/or modify it under
+ *	the terms of the GNU General Public License as published by the
+ *	Free Software Foundation, either version 3 of the License, or (at your
+ *	option) any later version.
+ *
+ *	It is distributed in the hope that it will be useful, but WITHOUT ANY
+ *	WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ *	FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ *	for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with it. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef NDC_SHA256_H_
+#define NDC_SHA256_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define SHA256_SIZE		32					// digest size in bytes
+#define SHA256_HEXSIZE	(SHA256_SIZE * 2)	// digest size in hex characters
+
+typedef struct {
+	uint32_t	state[8];
+	uint64_t	count;		// number of bytes processed
+	uint8_t		buf[64];	// pending block
+	} sha256_t;
+
+void sha256_init(sha256_t *ctx);
+void sha256_update(sha256_t *ctx, const void *data, size_t len);
+void sha256_final(sha256_t *ctx, uint8_t digest[SHA256_SIZE]);
+
+// hex string of the digest, 'hex' must have space for SHA256_HEXSIZE + 1 characters
+char *sha256_hex(const uint8_t digest[SHA256_SIZE], char *hex);
+
+#ifdef __cplusplus
+}
+#endif
+	
+#endif
+
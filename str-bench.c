@@ -0,0 +1,87 @@
+/*
+ * str-bench.c - u8width() / u8strlen() microbenchmark of str.c
+ *
+ * compares them with the previous versions (mbstowcs + wcswidth)
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+#include <locale.h>
+#include <time.h>
+#include "str.h"
+
+// previous versions
+static size_t old_u8width(const char *str) {
+	wchar_t *s = u8towcs(str);
+	int	n = wcswidth(s, wcslen(s));
+	free(s);
+	return n;
+	}
+
+static size_t old_u8strlen(const char *str) {
+	const char	*p = str;
+	size_t		cnt = 0;
+	while ( *p ) {
+		p += u8csize(*p);
+		cnt ++;
+		}
+	return cnt;
+	}
+
+static const char *samples[] = {
+	"notes",
+	"work/projects/2021",
+	"a rather long section name of a notebook, only ascii characters here",
+	"Σημειώσεις",
+	"ελληνικά και english μαζί, a mixed section name",
+	"日本語のノート",
+	"한국어 메모",
+	"e\xcc\x81t\xc3\xa9 cafe\xcc\x81",
+	"emoji \xf0\x9f\x98\x80 \xf0\x9f\x93\x9d",
+	NULL };
+
+static double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+	}
+
+#define LOOPS	200000
+
+int main(int argc, char *argv[]) {
+	volatile size_t sink = 0;
+	double	t;
+	int		i, j, errors = 0;
+	
+	setlocale(LC_ALL, "C.UTF-8");
+	
+	// check against the C library
+	for ( i = 0; samples[i]; i ++ ) {
+		size_t w = old_u8width(samples[i]), l = mbstowcs(NULL, samples[i], 0);
+		if ( u8width(samples[i]) != w || u8strlen(samples[i]) != l ) {
+			printf("MISMATCH [%s] width %zu/%zu length %zu/%zu\n", samples[i], u8width(samples[i]), w, u8strlen(samples[i]), l);
+			errors ++;
+			}
+		}
+	
+	printf("%-52s %10s %10s %10s\n", "string", "old ns", "new ns", "speedup");
+	for ( i = 0; samples[i]; i ++ ) {
+		double	o, n;
+		t = now();
+		for ( j = 0; j < LOOPS; j ++ )	sink += old_u8width(samples[i]);
+		o = (now() - t) * 1e9 / LOOPS;
+		t = now();
+		for ( j = 0; j < LOOPS; j ++ )	sink += u8width(samples[i]);
+		n = (now() - t) * 1e9 / LOOPS;
+		printf("u8width  %-43.43s %10.1f %10.1f %9.1fx\n", samples[i], o, n, o / n);
+		t = now();
+		for ( j = 0; j < LOOPS; j ++ )	sink += old_u8strlen(samples[i]);
+		o = (now() - t) * 1e9 / LOOPS;
+		t = now();
+		for ( j = 0; j < LOOPS; j ++ )	sink += u8strlen(samples[i]);
+		n = (now() - t) * 1e9 / LOOPS;
+		printf("u8strlen %-43.43s %10.1f %10.1f %9.1fx\n", samples[i], o, n, o / n);
+		}
+	return (errors) ? EXIT_FAILURE : EXIT_SUCCESS;
+	}
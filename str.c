@@ -24,6 +24,10 @@
 //#endif
 #include <wchar.h>
 #include <assert.h>
+#include <stdint.h>
+#if defined(__SSE2__)
+	#include <emmintrin.h>
+#endif
 #include "str.h"
 
 #ifndef MIN
@@ -110,25 +114,323 @@ wchar_t	u8towc(const char *str) {
 	return wch;
 	}
 
-// the length of string in characters (similar to u8width)
+// zero width (combining marks, format characters) and East Asian Wide/Fullwidth
+// ranges of code points from U+0300; unassigned code points are merged into the
+// ranges around them
+static const uint32_t u8_zero[][2] = {	{ 0x00300, 0x0036F }, { 0x00483, 0x00489 }, { 0x00591, 0x005BD }, { 0x005BF, 0x005BF },
+	{ 0x005C1, 0x005C2 }, { 0x005C4, 0x005C5 }, { 0x005C7, 0x005C7 }, { 0x00610, 0x0061A },
+	{ 0x0061C, 0x0061C }, { 0x0064B, 0x0065F }, { 0x00670, 0x00670 }, { 0x006D6, 0x006DC },
+	{ 0x006DF, 0x006E4 }, { 0x006E7, 0x006E8 }, { 0x006EA, 0x006ED }, { 0x00711, 0x00711 },
+	{ 0x00730, 0x0074A }, { 0x007A6, 0x007B0 }, { 0x007EB, 0x007F3 }, { 0x007FD, 0x007FD },
+	{ 0x00816, 0x00819 }, { 0x0081B, 0x00823 }, { 0x00825, 0x00827 }, { 0x00829, 0x0082D },
+	{ 0x00859, 0x0085B }, { 0x00898, 0x0089F }, { 0x008CA, 0x008E1 }, { 0x008E3, 0x00902 },
+	{ 0x0093A, 0x0093A }, { 0x0093C, 0x0093C }, { 0x00941, 0x00948 }, { 0x0094D, 0x0094D },
+	{ 0x00951, 0x00957 }, { 0x00962, 0x00963 }, { 0x00981, 0x00981 }, { 0x009BC, 0x009BC },
+	{ 0x009C1, 0x009C4 }, { 0x009CD, 0x009CD }, { 0x009E2, 0x009E3 }, { 0x009FE, 0x00A02 },
+	{ 0x00A3C, 0x00A3C }, { 0x00A41, 0x00A51 }, { 0x00A70, 0x00A71 }, { 0x00A75, 0x00A75 },
+	{ 0x00A81, 0x00A82 }, { 0x00ABC, 0x00ABC }, { 0x00AC1, 0x00AC8 }, { 0x00ACD, 0x00ACD },
+	{ 0x00AE2, 0x00AE3 }, { 0x00AFA, 0x00B01 }, { 0x00B3C, 0x00B3C }, { 0x00B3F, 0x00B3F },
+	{ 0x00B41, 0x00B44 }, { 0x00B4D, 0x00B56 }, { 0x00B62, 0x00B63 }, { 0x00B82, 0x00B82 },
+	{ 0x00BC0, 0x00BC0 }, { 0x00BCD, 0x00BCD }, { 0x00C00, 0x00C00 }, { 0x00C04, 0x00C04 },
+	{ 0x00C3C, 0x00C3C }, { 0x00C3E, 0x00C40 }, { 0x00C46, 0x00C56 }, { 0x00C62, 0x00C63 },
+	{ 0x00C81, 0x00C81 }, { 0x00CBC, 0x00CBC }, { 0x00CBF, 0x00CBF }, { 0x00CC6, 0x00CC6 },
+	{ 0x00CCC, 0x00CCD }, { 0x00CE2, 0x00CE3 }, { 0x00D00, 0x00D01 }, { 0x00D3B, 0x00D3C },
+	{ 0x00D41, 0x00D44 }, { 0x00D4D, 0x00D4D }, { 0x00D62, 0x00D63 }, { 0x00D81, 0x00D81 },
+	{ 0x00DCA, 0x00DCA }, { 0x00DD2, 0x00DD6 }, { 0x00E31, 0x00E31 }, { 0x00E34, 0x00E3A },
+	{ 0x00E47, 0x00E4E }, { 0x00EB1, 0x00EB1 }, { 0x00EB4, 0x00EBC }, { 0x00EC8, 0x00ECD },
+	{ 0x00F18, 0x00F19 }, { 0x00F35, 0x00F35 }, { 0x00F37, 0x00F37 }, { 0x00F39, 0x00F39 },
+	{ 0x00F71, 0x00F7E }, { 0x00F80, 0x00F84 }, { 0x00F86, 0x00F87 }, { 0x00F8D, 0x00FBC },
+	{ 0x00FC6, 0x00FC6 }, { 0x0102D, 0x01030 }, { 0x01032, 0x01037 }, { 0x01039, 0x0103A },
+	{ 0x0103D, 0x0103E }, { 0x01058, 0x01059 }, { 0x0105E, 0x01060 }, { 0x01071, 0x01074 },
+	{ 0x01082, 0x01082 }, { 0x01085, 0x01086 }, { 0x0108D, 0x0108D }, { 0x0109D, 0x0109D },
+	{ 0x01160, 0x011FF }, { 0x0135D, 0x0135F }, { 0x01712, 0x01714 }, { 0x01732, 0x01733 },
+	{ 0x01752, 0x01753 }, { 0x01772, 0x01773 }, { 0x017B4, 0x017B5 }, { 0x017B7, 0x017BD },
+	{ 0x017C6, 0x017C6 }, { 0x017C9, 0x017D3 }, { 0x017DD, 0x017DD }, { 0x0180B, 0x0180F },
+	{ 0x01885, 0x01886 }, { 0x018A9, 0x018A9 }, { 0x01920, 0x01922 }, { 0x01927, 0x01928 },
+	{ 0x01932, 0x01932 }, { 0x01939, 0x0193B }, { 0x01A17, 0x01A18 }, { 0x01A1B, 0x01A1B },
+	{ 0x01A56, 0x01A56 }, { 0x01A58, 0x01A60 }, { 0x01A62, 0x01A62 }, { 0x01A65, 0x01A6C },
+	{ 0x01A73, 0x01A7F }, { 0x01AB0, 0x01B03 }, { 0x01B34, 0x01B34 }, { 0x01B36, 0x01B3A },
+	{ 0x01B3C, 0x01B3C }, { 0x01B42, 0x01B42 }, { 0x01B6B, 0x01B73 }, { 0x01B80, 0x01B81 },
+	{ 0x01BA2, 0x01BA5 }, { 0x01BA8, 0x01BA9 }, { 0x01BAB, 0x01BAD }, { 0x01BE6, 0x01BE6 },
+	{ 0x01BE8, 0x01BE9 }, { 0x01BED, 0x01BED }, { 0x01BEF, 0x01BF1 }, { 0x01C2C, 0x01C33 },
+	{ 0x01C36, 0x01C37 }, { 0x01CD0, 0x01CD2 }, { 0x01CD4, 0x01CE0 }, { 0x01CE2, 0x01CE8 },
+	{ 0x01CED, 0x01CED }, { 0x01CF4, 0x01CF4 }, { 0x01CF8, 0x01CF9 }, { 0x01DC0, 0x01DFF },
+	{ 0x0200B, 0x0200F }, { 0x0202A, 0x0202E }, { 0x02060, 0x0206F }, { 0x020D0, 0x020F0 },
+	{ 0x02CEF, 0x02CF1 }, { 0x02D7F, 0x02D7F }, { 0x02DE0, 0x02DFF }, { 0x0302A, 0x0302D },
+	{ 0x03099, 0x0309A }, { 0x0A66F, 0x0A672 }, { 0x0A674, 0x0A67D }, { 0x0A69E, 0x0A69F },
+	{ 0x0A6F0, 0x0A6F1 }, { 0x0A802, 0x0A802 }, { 0x0A806, 0x0A806 }, { 0x0A80B, 0x0A80B },
+	{ 0x0A825, 0x0A826 }, { 0x0A82C, 0x0A82C }, { 0x0A8C4, 0x0A8C5 }, { 0x0A8E0, 0x0A8F1 },
+	{ 0x0A8FF, 0x0A8FF }, { 0x0A926, 0x0A92D }, { 0x0A947, 0x0A951 }, { 0x0A980, 0x0A982 },
+	{ 0x0A9B3, 0x0A9B3 }, { 0x0A9B6, 0x0A9B9 }, { 0x0A9BC, 0x0A9BD }, { 0x0A9E5, 0x0A9E5 },
+	{ 0x0AA29, 0x0AA2E }, { 0x0AA31, 0x0AA32 }, { 0x0AA35, 0x0AA36 }, { 0x0AA43, 0x0AA43 },
+	{ 0x0AA4C, 0x0AA4C }, { 0x0AA7C, 0x0AA7C }, { 0x0AAB0, 0x0AAB0 }, { 0x0AAB2, 0x0AAB4 },
+	{ 0x0AAB7, 0x0AAB8 }, { 0x0AABE, 0x0AABF }, { 0x0AAC1, 0x0AAC1 }, { 0x0AAEC, 0x0AAED },
+	{ 0x0AAF6, 0x0AAF6 }, { 0x0ABE5, 0x0ABE5 }, { 0x0ABE8, 0x0ABE8 }, { 0x0ABED, 0x0ABED },
+	{ 0x0D7B0, 0x0D7FB }, { 0x0FB1E, 0x0FB1E }, { 0x0FE00, 0x0FE0F }, { 0x0FE20, 0x0FE2F },
+	{ 0x0FEFF, 0x0FEFF }, { 0x0FFF9, 0x0FFFB }, { 0x101FD, 0x101FD }, { 0x102E0, 0x102E0 },
+	{ 0x10376, 0x1037A }, { 0x10A01, 0x10A0F }, { 0x10A38, 0x10A3F }, { 0x10AE5, 0x10AE6 },
+	{ 0x10D24, 0x10D27 }, { 0x10EAB, 0x10EAC }, { 0x10F46, 0x10F50 }, { 0x10F82, 0x10F85 },
+	{ 0x11001, 0x11001 }, { 0x11038, 0x11046 }, { 0x11070, 0x11070 }, { 0x11073, 0x11074 },
+	{ 0x1107F, 0x11081 }, { 0x110B3, 0x110B6 }, { 0x110B9, 0x110BA }, { 0x110C2, 0x110C2 },
+	{ 0x11100, 0x11102 }, { 0x11127, 0x1112B }, { 0x1112D, 0x11134 }, { 0x11173, 0x11173 },
+	{ 0x11180, 0x11181 }, { 0x111B6, 0x111BE }, { 0x111C9, 0x111CC }, { 0x111CF, 0x111CF },
+	{ 0x1122F, 0x11231 }, { 0x11234, 0x11234 }, { 0x11236, 0x11237 }, { 0x1123E, 0x1123E },
+	{ 0x112DF, 0x112DF }, { 0x112E3, 0x112EA }, { 0x11300, 0x11301 }, { 0x1133B, 0x1133C },
+	{ 0x11340, 0x11340 }, { 0x11366, 0x11374 }, { 0x11438, 0x1143F }, { 0x11442, 0x11444 },
+	{ 0x11446, 0x11446 }, { 0x1145E, 0x1145E }, { 0x114B3, 0x114B8 }, { 0x114BA, 0x114BA },
+	{ 0x114BF, 0x114C0 }, { 0x114C2, 0x114C3 }, { 0x115B2, 0x115B5 }, { 0x115BC, 0x115BD },
+	{ 0x115BF, 0x115C0 }, { 0x115DC, 0x115DD }, { 0x11633, 0x1163A }, { 0x1163D, 0x1163D },
+	{ 0x1163F, 0x11640 }, { 0x116AB, 0x116AB }, { 0x116AD, 0x116AD }, { 0x116B0, 0x116B5 },
+	{ 0x116B7, 0x116B7 }, { 0x1171D, 0x1171F }, { 0x11722, 0x11725 }, { 0x11727, 0x1172B },
+	{ 0x1182F, 0x11837 }, { 0x11839, 0x1183A }, { 0x1193B, 0x1193C }, { 0x1193E, 0x1193E },
+	{ 0x11943, 0x11943 }, { 0x119D4, 0x119DB }, { 0x119E0, 0x119E0 }, { 0x11A01, 0x11A0A },
+	{ 0x11A33, 0x11A38 }, { 0x11A3B, 0x11A3E }, { 0x11A47, 0x11A47 }, { 0x11A51, 0x11A56 },
+	{ 0x11A59, 0x11A5B }, { 0x11A8A, 0x11A96 }, { 0x11A98, 0x11A99 }, { 0x11C30, 0x11C3D },
+	{ 0x11C3F, 0x11C3F }, { 0x11C92, 0x11CA7 }, { 0x11CAA, 0x11CB0 }, { 0x11CB2, 0x11CB3 },
+	{ 0x11CB5, 0x11CB6 }, { 0x11D31, 0x11D45 }, { 0x11D47, 0x11D47 }, { 0x11D90, 0x11D91 },
+	{ 0x11D95, 0x11D95 }, { 0x11D97, 0x11D97 }, { 0x11EF3, 0x11EF4 }, { 0x13430, 0x13438 },
+	{ 0x16AF0, 0x16AF4 }, { 0x16B30, 0x16B36 }, { 0x16F4F, 0x16F4F }, { 0x16F8F, 0x16F92 },
+	{ 0x16FE4, 0x16FE4 }, { 0x1BC9D, 0x1BC9E }, { 0x1BCA0, 0x1CF46 }, { 0x1D167, 0x1D169 },
+	{ 0x1D173, 0x1D182 }, { 0x1D185, 0x1D18B }, { 0x1D1AA, 0x1D1AD }, { 0x1D242, 0x1D244 },
+	{ 0x1DA00, 0x1DA36 }, { 0x1DA3B, 0x1DA6C }, { 0x1DA75, 0x1DA75 }, { 0x1DA84, 0x1DA84 },
+	{ 0x1DA9B, 0x1DAAF }, { 0x1E000, 0x1E02A }, { 0x1E130, 0x1E136 }, { 0x1E2AE, 0x1E2AE },
+	{ 0x1E2EC, 0x1E2EF }, { 0x1E8D0, 0x1E8D6 }, { 0x1E944, 0x1E94A }, { 0xE0001, 0xE01EF },
+	};
+static const uint32_t u8_wide[][2] = {	{ 0x01100, 0x0115F }, { 0x0231A, 0x0231B }, { 0x02329, 0x0232A }, { 0x023E9, 0x023EC },
+	{ 0x023F0, 0x023F0 }, { 0x023F3, 0x023F3 }, { 0x025FD, 0x025FE }, { 0x02614, 0x02615 },
+	{ 0x02648, 0x02653 }, { 0x0267F, 0x0267F }, { 0x02693, 0x02693 }, { 0x026A1, 0x026A1 },
+	{ 0x026AA, 0x026AB }, { 0x026BD, 0x026BE }, { 0x026C4, 0x026C5 }, { 0x026CE, 0x026CE },
+	{ 0x026D4, 0x026D4 }, { 0x026EA, 0x026EA }, { 0x026F2, 0x026F3 }, { 0x026F5, 0x026F5 },
+	{ 0x026FA, 0x026FA }, { 0x026FD, 0x026FD }, { 0x02705, 0x02705 }, { 0x0270A, 0x0270B },
+	{ 0x02728, 0x02728 }, { 0x0274C, 0x0274C }, { 0x0274E, 0x0274E }, { 0x02753, 0x02755 },
+	{ 0x02757, 0x02757 }, { 0x02795, 0x02797 }, { 0x027B0, 0x027B0 }, { 0x027BF, 0x027BF },
+	{ 0x02B1B, 0x02B1C }, { 0x02B50, 0x02B50 }, { 0x02B55, 0x02B55 }, { 0x02E80, 0x03029 },
+	{ 0x0302E, 0x0303E }, { 0x03041, 0x03096 }, { 0x0309B, 0x0A4C6 }, { 0x0A960, 0x0A97C },
+	{ 0x0AC00, 0x0D7A3 }, { 0x0F900, 0x0FAD9 }, { 0x0FE10, 0x0FE19 }, { 0x0FE30, 0x0FE6B },
+	{ 0x0FF01, 0x0FF60 }, { 0x0FFE0, 0x0FFE6 }, { 0x16FE0, 0x16FE3 }, { 0x16FF0, 0x1B2FB },
+	{ 0x1F004, 0x1F004 }, { 0x1F0CF, 0x1F0CF }, { 0x1F18E, 0x1F18E }, { 0x1F191, 0x1F19A },
+	{ 0x1F200, 0x1F320 }, { 0x1F32D, 0x1F335 }, { 0x1F337, 0x1F37C }, { 0x1F37E, 0x1F393 },
+	{ 0x1F3A0, 0x1F3CA }, { 0x1F3CF, 0x1F3D3 }, { 0x1F3E0, 0x1F3F0 }, { 0x1F3F4, 0x1F3F4 },
+	{ 0x1F3F8, 0x1F43E }, { 0x1F440, 0x1F440 }, { 0x1F442, 0x1F4FC }, { 0x1F4FF, 0x1F53D },
+	{ 0x1F54B, 0x1F54E }, { 0x1F550, 0x1F567 }, { 0x1F57A, 0x1F57A }, { 0x1F595, 0x1F596 },
+	{ 0x1F5A4, 0x1F5A4 }, { 0x1F5FB, 0x1F64F }, { 0x1F680, 0x1F6C5 }, { 0x1F6CC, 0x1F6CC },
+	{ 0x1F6D0, 0x1F6D2 }, { 0x1F6D5, 0x1F6DF }, { 0x1F6EB, 0x1F6EC }, { 0x1F6F4, 0x1F6FC },
+	{ 0x1F7E0, 0x1F7F0 }, { 0x1F90C, 0x1F93A }, { 0x1F93C, 0x1F945 }, { 0x1F947, 0x1F9FF },
+	{ 0x1FA70, 0x1FAF6 }, { 0x20000, 0x3134A },
+	};
+
+// true if 'cp' is in the ranges of 'table'
+static bool u8_inrange(uint32_t cp, const uint32_t (*table)[2], size_t count) {
+	size_t	lo = 0, hi = count, mid;
+	
+	if ( cp < table[0][0] || cp > table[count - 1][1] )
+		return false;
+	while ( lo < hi ) {
+		mid = (lo + hi) / 2;
+		if ( cp > table[mid][1] )		lo = mid + 1;
+		else if ( cp < table[mid][0] )	hi = mid;
+		else							return true;
+		}
+	return false;
+	}
+
+// blocks of 64 code points of the BMP that have characters of the tables
+static uint64_t u8_mixed[1024 / 64];
+static bool u8_mixed_ready;
+
+static void u8_mixed_mark(const uint32_t (*table)[2], size_t count) {
+	for ( size_t i = 0; i < count && table[i][0] < 0x10000; i ++ )
+		for ( uint32_t b = table[i][0] >> 6; b <= (MIN(table[i][1], 0xFFFF) >> 6); b ++ )
+			u8_mixed[b >> 6] |= 1ULL << (b & 63);
+	}
+
+// width in screen-columns of the code point 'cp' (non-ascii)
+static int u8_cpwidth(uint32_t cp) {
+	if ( cp < 0xA0 )	return 0; // C1 controls
+	if ( cp < 0x300 )	return 1;
+	if ( (cp >= 0x4E00 && cp <= 0x9FFF) || (cp >= 0xAC00 && cp <= 0xD7A3) )
+		return 2; // CJK ideographs, Hangul syllables
+	if ( cp < 0x10000 ) {
+		if ( !u8_mixed_ready ) {
+			u8_mixed_mark(u8_zero, sizeof(u8_zero) / sizeof(u8_zero[0]));
+			u8_mixed_mark(u8_wide, sizeof(u8_wide) / sizeof(u8_wide[0]));
+			u8_mixed_ready = true;
+			}
+		if ( !(u8_mixed[cp >> 12] & (1ULL << ((cp >> 6) & 63))) )
+			return 1;
+		}
+	if ( u8_inrange(cp, u8_zero, sizeof(u8_zero) / sizeof(u8_zero[0])) )
+		return 0;
+	if ( cp >= 0x1100 && u8_inrange(cp, u8_wide, sizeof(u8_wide) / sizeof(u8_wide[0])) )
+		return 2;
+	return 1;
+	}
+
+// decode the non-ascii utf8 character at 'p'; returns its size in bytes;
+// invalid sequences are decoded as one U+FFFD per byte
+static int u8_decode(const unsigned char *p, uint32_t *cp) {
+	if ( p[0] >= 0xC2 && p[0] < 0xE0 && (p[1] & 0xC0) == 0x80 ) {
+		*cp = ((p[0] & 0x1F) << 6) | (p[1] & 0x3F);
+		return 2;
+		}
+	if ( p[0] >= 0xE0 && p[0] < 0xF0 && (p[1] & 0xC0) == 0x80 && (p[2] & 0xC0) == 0x80 ) {
+		*cp = ((p[0] & 0x0F) << 12) | ((p[1] & 0x3F) << 6) | (p[2] & 0x3F);
+		return 3;
+		}
+	if ( p[0] >= 0xF0 && p[0] < 0xF5 && (p[1] & 0xC0) == 0x80 && (p[2] & 0xC0) == 0x80 && (p[3] & 0xC0) == 0x80 ) {
+		*cp = ((p[0] & 0x07) << 18) | ((p[1] & 0x3F) << 12) | ((p[2] & 0x3F) << 6) | (p[3] & 0x3F);
+		return 4;
+		}
+	*cp = 0xFFFD;
+	return 1;
+	}
+
+// The ascii fast paths read blocks of 16 bytes (SSE2) that do not cross a page, or
+// aligned words of 8 bytes; so the bytes after the terminator can be read safely.
+#define U8_PAGE_OK(p)	(((uintptr_t) (p) & 4095) <= 4096 - 16)
+#define U8_ONES		0x0101010101010101ULL
+#define U8_HIGHS	0x8080808080808080ULL
+
+// the length of string in characters (not bytes); no allocation
 size_t	u8strlen(const char *str) {
-	const char	*p = str;
-	size_t		cnt = 0, len;
-	while ( *p ) {
-		len = u8csize(*p);
-		p += len;
-		cnt ++;
+	const unsigned char *p = (const unsigned char *) str;
+	size_t	cnt = 0;
+
+#if defined(__SSE2__)
+	// count the bytes that are not continuation bytes (0x80..0xBF)
+	const __m128i zero = _mm_setzero_si128(), cont = _mm_set1_epi8((char) 0xBF);
+	for ( ;; ) {
+		if ( U8_PAGE_OK(p) ) {
+			__m128i	v = _mm_loadu_si128((const __m128i *) p);
+			unsigned nul = _mm_movemask_epi8(_mm_cmpeq_epi8(v, zero));
+			unsigned chr = _mm_movemask_epi8(_mm_cmpgt_epi8(v, cont));
+			if ( nul ) {
+				chr &= (nul & -nul) - 1; // before the terminator
+				return cnt + __builtin_popcount(chr);
+				}
+			cnt += __builtin_popcount(chr);
+			p += 16;
+			}
+		else {
+			if ( *p == 0 )	return cnt;
+			if ( (*p & 0xC0) != 0x80 ) cnt ++;
+			p ++;
+			}
+		}
+#else
+	for ( ; ((uintptr_t) p & 7); p ++ ) {
+		if ( *p == 0 )	return cnt;
+		if ( (*p & 0xC0) != 0x80 ) cnt ++;
+		}
+	for ( ;; p += 8 ) {
+		uint64_t x = *((const uint64_t *) p);
+		if ( ((x - U8_ONES) & ~x & U8_HIGHS) ) // has terminator
+			break;
+		// continuation bytes have bit7 set and bit6 clear
+		cnt += 8 - __builtin_popcountll(x & ~(x << 1) & U8_HIGHS);
 		}
+	for ( ; *p; p ++ )
+		if ( (*p & 0xC0) != 0x80 ) cnt ++;
 	return cnt;
+#endif
 	}
 
-// width in screen-columns of wcs
+// width in screen-columns of utf8 string; control characters have no width;
+// no allocation
 size_t u8width(const char *str) {
-	wchar_t *s = u8towcs(str);
-	int	n = wcswidth(s, wcslen(s));
-	free(s);
+	const unsigned char *p = (const unsigned char *) str;
+	size_t	w = 0;
+	uint32_t cp;
+
+	for ( ;; ) {
+		// whole blocks of printable ascii
+#if defined(__SSE2__)
+		if ( U8_PAGE_OK(p) ) {
+			const __m128i space = _mm_set1_epi8(0x20), del = _mm_set1_epi8(0x7F);
+			for ( ; U8_PAGE_OK(p); p += 16, w += 16 ) {
+				__m128i	v = _mm_loadu_si128((const __m128i *) p);
+				// signed: the bytes >= 0x80 are less than space too
+				if ( _mm_movemask_epi8(_mm_or_si128(_mm_cmplt_epi8(v, space), _mm_cmpeq_epi8(v, del))) )
+					break;
+				}
+			}
+#else
+		if ( ((uintptr_t) p & 7) == 0 ) {
+			for ( ;; p += 8, w += 8 ) {
+				uint64_t x = *((const uint64_t *) p), y = x ^ (0x7F * U8_ONES);
+				if ( (x & U8_HIGHS) || ((x - 0x20 * U8_ONES) & ~x & U8_HIGHS) || ((y - U8_ONES) & ~y & U8_HIGHS) )
+					break;
+				}
+			}
+#endif
+		if ( *p < 0x80 ) {
+			if ( *p == 0 )
+				break;
+			if ( *p >= 0x20 && *p != 0x7F )
+				w ++;
+			p ++;
+			}
+		else {
+			p += u8_decode(p, &cp);
+			w += u8_cpwidth(cp);
+			}
+		}
+	return w;
+	}
+
+// the number of bytes of 'buf' that are not found in text: NUL and the control
+// characters except BS, TAB, LF, VT, FF, CR and ESC
+size_t	ctlcount(const char *buf, size_t len) {
+	const unsigned char *p = (const unsigned char *) buf;
+	size_t	i = 0, n = 0;
+
+#if defined(__SSE2__)
+	const __m128i c1f = _mm_set1_epi8(0x1F), bs = _mm_set1_epi8(8), cr = _mm_set1_epi8(13), esc = _mm_set1_epi8(27);
+	for ( ; i + 16 <= len; i += 16 ) {
+		__m128i	v = _mm_loadu_si128((const __m128i *) (p + i));
+		__m128i	ctl = _mm_cmpeq_epi8(_mm_min_epu8(v, c1f), v);	// v <= 0x1F
+		__m128i	ok = _mm_or_si128(_mm_cmpeq_epi8(_mm_max_epu8(_mm_min_epu8(v, cr), bs), v), _mm_cmpeq_epi8(v, esc));
+		n += __builtin_popcount(_mm_movemask_epi8(_mm_andnot_si128(ok, ctl)));
+		}
+#endif
+	for ( ; i < len; i ++ )
+		if ( p[i] < 0x20 && (p[i] < 8 || p[i] > 13) && p[i] != 27 )
+			n ++;
 	return n;
-//	return u8strlen(str);
+	}
+
+// the number of bytes of 'str' (up to 'len', no terminator needed) that fit on the
+// screen from column '*col' up to 'maxcol'; '*col' is advanced; the columns are
+// those of waddnstr(): tabs stop at multiples of 8, control characters are ^X
+size_t u8fit(const char *str, size_t len, size_t *col, size_t maxcol) {
+	const unsigned char *p = (const unsigned char *) str;
+	size_t	i = 0, c = *col, w, n;
+	uint32_t cp;
+
+	while ( i < len ) {
+		if ( p[i] < 0x80 ) {
+			if ( p[i] == '\t' )
+				w = 8 - (c & 7);
+			else
+				w = ( p[i] < 0x20 || p[i] == 0x7F ) ? 2 : 1;
+			n = 1;
+			}
+		else if ( (size_t) u8csize(p[i]) > len - i ) {
+			cp = 0xFFFD; // truncated sequence at the end
+			w = 1;
+			n = 1;
+			}
+		else {
+			n = u8_decode(p + i, &cp);
+			w = u8_cpwidth(cp);
+			}
+		if ( c + w > maxcol )
+			break;
+		c += w;
+		i += n;
+		}
+	*col = c;
+	return i;
 	}
 
 // append source to string base
@@ -303,6 +605,49 @@ cwords_t *strtocwords(char *buf) {
 	return list;
 	}
 
+// initialize an empty buffer
+void sbuf_init(sbuf_t *sb) {
+	sb->alloc = 64;
+	sb->len = 0;
+	sb->ptr = (char *) malloc(sb->alloc);
+	sb->ptr[0] = '\0';
+	}
+
+// release the memory of the buffer
+void sbuf_free(sbuf_t *sb) {
+	free(sb->ptr);
+	sb->ptr = NULL;
+	sb->len = sb->alloc = 0;
+	}
+
+// empty the string, keeps the allocated memory
+void sbuf_clear(sbuf_t *sb) {
+	sb->len = 0;
+	sb->ptr[0] = '\0';
+	}
+
+// append 'n' bytes of 'src'; the allocation grows geometrically
+void sbuf_addn(sbuf_t *sb, const char *src, size_t n) {
+	if ( sb->len + n + 1 > sb->alloc ) {
+		while ( sb->len + n + 1 > sb->alloc )
+			sb->alloc <<= 1;
+		sb->ptr = (char *) realloc(sb->ptr, sb->alloc);
+		}
+	memcpy(sb->ptr + sb->len, src, n);
+	sb->len += n;
+	sb->ptr[sb->len] = '\0';
+	}
+
+void sbuf_add(sbuf_t *sb, const char *src)	{ sbuf_addn(sb, src, strlen(src)); }
+void sbuf_addc(sbuf_t *sb, int c)			{ char ch = c; sbuf_addn(sb, &ch, 1); }
+
+// returns the string and reinitializes the buffer; the caller frees the string
+char *sbuf_detach(sbuf_t *sb) {
+	char *str = sb->ptr;
+	sbuf_init(sb);
+	return str;
+	}
+
 //
 const char *parse_num(const char *src, char *buf) {
 	const char *p = src;
@@ -389,38 +734,82 @@ int res_replace(const char *pattern, char *source, const char *repl, size_t max_
 	return status;
 	}
 
-// converts a text to text-lines table
-char	**text_to_lines(const char *src) {
-	char	*str = strdup(src), *p, *ps;
-	char	**table;
-	int		lines, len, pos;
+// prepares the line index of 'text'; nothing is scanned yet
+void lindex_init(lindex_t *li, const char *text, size_t size) {
+	li->text = text;
+	li->size = size;
+	li->count = 0;
+	li->alloc = 256;
+	li->lines = (size_t *) malloc(sizeof(size_t) * li->alloc);
+	li->lines[0] = 0;
+	li->complete = (size == 0);
+	}
+
+//
+void lindex_free(lindex_t *li) {
+	free(li->lines);
+	li->lines = NULL;
+	li->count = 0;
+	}
+
+// indexes one more line; returns false at the end of the text
+static bool lindex_next(lindex_t *li) {
+	size_t	pos = li->lines[li->count];
+	const char *p;
 
-	len = strlen(str);
-	if ( len && str[len-1] != '\n' ) {
-		str[len] = '\n';
-		str[++ len] = '\0';
+	if ( pos >= li->size ) {
+		li->complete = true;
+		return false;
 		}
-	for ( p = str, lines = 0; *p; p ++ )
-		if ( *p == '\n' ) lines ++;
-	table = (char **) malloc(sizeof(char*) * (lines + 1));
-	table[lines] = NULL;
-	pos = 0;
-	for ( ps = p = str; *p; p ++ ) {
-		if ( *p == '\n' ) {
-			*p = '\0';
-			table[pos ++] = strdup(ps);
-			ps = p + 1;
-			}
+	if ( li->count + 2 > li->alloc ) {
+		li->alloc <<= 1;
+		li->lines = (size_t *) realloc(li->lines, sizeof(size_t) * li->alloc);
 		}
-	free(str);
-	return table;
+	p = memchr(li->text + pos, '\n', li->size - pos);
+	li->lines[++ li->count] = ( p ) ? p - li->text + 1 : li->size;
+	return true;
 	}
 
-// frees a text-lines table
-char **free_text_lines(char **table) {
-	for ( int i = 0; table[i]; i ++ )
-		free(table[i]);
-	free(table);
-	return NULL;
+// indexes the text up to the 'n'th line; returns true if the line exists
+bool lindex_has(lindex_t *li, size_t n) {
+	if ( n >= li->count && li->complete )
+		return false;
+	while ( li->count <= n && lindex_next(li) );
+	return n < li->count;
+	}
+
+// indexes the whole text; returns the number of lines
+size_t lindex_count(lindex_t *li) {
+	if ( !li->complete )
+		while ( lindex_next(li) );
+	return li->count;
+	}
+
+// returns the 'n'th line (already indexed) and its length in '*len', without the newline (or CR-LF)
+const char *lindex_line(const lindex_t *li, size_t n, size_t *len) {
+	const char *p = li->text + li->lines[n];
+	size_t	l = li->lines[n + 1] - li->lines[n];
+
+	if ( l && p[l - 1] == '\n' ) l --;
+	if ( l && p[l - 1] == '\r' ) l --;
+	*len = l;
+	return p;
+	}
+
+// returns the line that contains the byte at 'offset' (< size)
+size_t lindex_find(lindex_t *li, size_t offset) {
+	size_t	lo = 0, hi;
+
+	while ( li->lines[li->count] <= offset && lindex_next(li) );
+	hi = li->count;
+
+	while ( hi - lo > 1 ) {
+		size_t	mid = lo + (hi - lo) / 2;
+		if ( li->lines[mid] <= offset )
+			lo = mid;
+		else
+			hi = mid;
+		}
+	return lo;
 	}
 
@@ -44,6 +44,28 @@ typedef struct {
 	int	alloc;			// allocation size (used for realloc)
 	} cwords_t;
 
+/*
+ *	growable string buffer
+ */
+typedef struct {
+	char	*ptr;		// the string, always null terminated
+	size_t	len;		// length in bytes
+	size_t	alloc;		// allocation size
+	} sbuf_t;
+
+/*
+ *	line index of a text; the lines are offsets into the text, nothing is copied;
+ *	the text is indexed lazily, up to the lines that are asked
+ */
+typedef struct {
+	const char	*text;	// the text (not owned), does not need to be null terminated
+	size_t	size;		// size of the text in bytes
+	size_t	*lines;		// start of each line, lines[count] is where the indexing stopped
+	size_t	count;		// number of lines indexed so far
+	size_t	alloc;		// allocation size (in items) of lines
+	bool	complete;	// the whole text is indexed
+	} lindex_t;
+
 // utf8
 wchar_t *u8towcs(const char *u8str);
 char *wcstou8(const wchar_t *wcs);
@@ -52,6 +74,8 @@ void	u8cpytostr(char *u8buf, const wchar_t *wcs);
 void	u8cpytowcs(wchar_t *wcs, const char *u8str);
 size_t	u8strlen(const char *str);
 size_t	u8width(const char *str);
+size_t	u8fit(const char *str, size_t len, size_t *col, size_t maxcol);
+size_t	ctlcount(const char *buf, size_t len);
 int		u8csize(unsigned char c);
 bool	u8ischar(int c);
 
@@ -83,6 +107,15 @@ const cwords_t *cwords_destroy(cwords_t *list);
 int cwords_add(cwords_t *list, const char *src);
 cwords_t *strtocwords(char *buf);
 
+// growable string buffer
+void	sbuf_init(sbuf_t *sb);
+void	sbuf_free(sbuf_t *sb);
+void	sbuf_clear(sbuf_t *sb);
+void	sbuf_addn(sbuf_t *sb, const char *src, size_t n);
+void	sbuf_add(sbuf_t *sb, const char *src);
+void	sbuf_addc(sbuf_t *sb, int c);
+char	*sbuf_detach(sbuf_t *sb);
+
 // regex
 int res_match(const char *pattern, const char *source);
 int rex_match(regex_t *r, const char *source);
@@ -93,9 +126,13 @@ int rex_replace(regex_t *r, char *source, const char *repl, size_t max_matches);
 const char *parse_num(const char *src, char *buf);
 const char *parse_const(const char *src, const char *str);
 
-// utilities
-char **text_to_lines(const char *src);
-char **free_text_lines(char **table);
+// line index
+void	lindex_init(lindex_t *li, const char *text, size_t size);
+void	lindex_free(lindex_t *li);
+bool	lindex_has(lindex_t *li, size_t n);
+size_t	lindex_count(lindex_t *li);
+const char *lindex_line(const lindex_t *li, size_t n, size_t *len);
+size_t	lindex_find(lindex_t *li, size_t offset);
 
 #ifdef __cplusplus
 }